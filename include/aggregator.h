@@ -0,0 +1,48 @@
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <time.h>
+#include "edsac_representation.h"
+#include "hashindex.h"
+#include "network.h"
+
+#define AGGREGATION_WINDOW_MS 1000
+#define AGGREGATED_MSG_LEN 128
+
+typedef struct {
+    MessageType type;
+    int valveNo;
+    int count;
+    int relay;
+    struct timespec first;
+    struct timespec last;
+    Message* sample;
+} AggregatedMessage;
+
+/*
+ * Collapses repeated messages with the same type and valve within a window
+ * into one entry, which is printed and relayed once when the window closes
+ */
+typedef struct {
+    AggregatedMessage* entries;
+    int n;
+    HashIndex* indices;
+    struct timespec windowStart;
+    int windowMs;
+} MessageAggregator;
+
+MessageAggregator* createMessageAggregator(int windowMs);
+void freeMessageAggregator(MessageAggregator* aggregator);
+void aggregateMessage(MessageAggregator* aggregator, NetworkHandle* net, Message* msg, 
+        const struct timespec* received, int relay);
+void flushMessageAggregator(MessageAggregator* aggregator, NetworkHandle* net);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AGGREGATOR_H */
@@ -5,13 +5,42 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include <libxml/tree.h>
+#include "bdd.h"
+#include "hashindex.h"
+
+#define TRUTH_WORD_BITS 64
+#define MAX_TRUTH_TABLE_INPUTS 20
+
+typedef uint64_t TruthWord;
+    
+typedef enum {
+    NODE_UNEVALUATED, NODE_EVALUATING, NODE_EVALUATED
+} NodeEvaluationState;
+
+/*
+ * A node whose table is just that of another, such as a TP wrapping a ref,
+ * shares that table rather than owning one
+ */
+typedef struct {
+    NodeEvaluationState state;
+    TruthWord* truth;
+    int sharedTruth;
+    BddRef bdd;
+    int depth;
+    int valveNo;
+} NodeEvaluation;
     
 typedef struct {
     xmlNode** inputTpNodes;
     int nInputs;
+    HashIndex* inputIndices;
     xmlNode** nodes;
+    NodeEvaluation* evaluations;
     int n;
+    HashIndex* idIndices;
+    BddManager* bdd;
 } NodeIdMap;
     
 typedef struct {
@@ -19,28 +48,36 @@ typedef struct {
     int valveNo;
     int isIndex;
     float min, max;
-    int* truth;
+    TruthWord* truth;
+    BddRef bdd;
 } TestPoint;
     
+/*
+ * TPs that refer to the same node share its table, so the set owns the
+ * distinct tables in truths rather than each TP owning its own
+ */
 typedef struct {
     TestPoint** tps;
     int nTp;
+    TruthWord** truths;
+    int nTruths;
     int nInputs;
+    int* inputRowBits;
+    HashIndex* tpIndices;
+    BddManager* bdd;
+    int evaluated;
 } AssertionsSet;
 
-typedef struct LinkedListSortingNode LinkedListSortingNode;
-
-struct LinkedListSortingNode {
-    TestPoint* tp;
-    int depth;
-    LinkedListSortingNode* prev;
-    LinkedListSortingNode* next;
-};
-
+int getTruthTableWords(int nInputs);
+int getTruthTableValue(const TruthWord* truth, int row);
+int getIndexOfTPNameInSet(AssertionsSet* set, const char* tpName);
 int getIndexOfTPNodeInSet(AssertionsSet* set, xmlNode* node);
 AssertionsSet* createAssertionSetFromXMLNode(xmlNode* circuitNode);
+AssertionsSet* createUnevaluatedAssertionSetFromXMLNode(xmlNode* circuitNode);
 void freeAssertionSet(AssertionsSet* set);
+int findTableRowForInputs(AssertionsSet* set, int* samples);
 void checkTruthTable(AssertionsSet* set, int* samples, int* dest, int* n);
+void checkTruthTableBatch(AssertionsSet* set, int* samples, int nVectors, int* dest, int* n);
 void printTruthTable(AssertionsSet* set);
 void printTPs(AssertionsSet* set);
 
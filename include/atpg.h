@@ -0,0 +1,33 @@
+#ifndef ATPG_H
+#define ATPG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "faultsim.h"
+
+/*
+ * nSampled is the number of vectors the test set was picked from when the
+ * fault simulation only covered a sample of them, or 0 when it covered all
+ */
+typedef struct {
+    int* vectors;
+    int nVectors;
+    int nSampled;
+    int nFaults;
+    int nDetectable;
+    int nCovered;
+} TestSet;
+
+TestSet* generateTestSet(FaultSimulation* sim);
+void freeTestSet(TestSet* testSet);
+int countTestSetDetections(FaultSimulation* sim, TestSet* testSet, FaultResponse* response);
+void printTestSet(TestSet* testSet);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ATPG_H */
+
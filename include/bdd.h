@@ -0,0 +1,45 @@
+#ifndef BDD_H
+#define BDD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "hashindex.h"
+
+#define BDD_FALSE 0
+#define BDD_TRUE 1
+#define BDD_INVALID -1
+
+typedef int BddRef;
+
+typedef struct {
+    int var;
+    BddRef low;
+    BddRef high;
+} BddNode;
+
+typedef struct {
+    BddNode* nodes;
+    int nNodes;
+    int capacity;
+    int nVars;
+    HashIndex* unique;
+    HashIndex* computed;
+} BddManager;
+
+BddManager* createBddManager(int nVars);
+void freeBddManager(BddManager* bdd);
+BddRef bddVar(BddManager* bdd, int var);
+BddRef bddNot(BddManager* bdd, BddRef a);
+BddRef bddAnd(BddManager* bdd, BddRef a, BddRef b);
+BddRef bddOr(BddManager* bdd, BddRef a, BddRef b);
+int bddTopVar(BddManager* bdd, BddRef a);
+int bddEvaluate(BddManager* bdd, BddRef a, const int* values);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BDD_H */
+
@@ -0,0 +1,52 @@
+#ifndef CAMPAIGN_H
+#define CAMPAIGN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+
+#define MAX_RIG_FIELD_LEN 64
+#define MAX_RIG_LINE_LEN 512
+#define RIG_LOG_FILENAME_FORMAT "rig%d.log"
+
+/*
+ * nFailed is -1 if the rig could not be set up
+ */
+typedef struct {
+    int nFailed;
+    int nInjections;
+    double elapsedS;
+} RigResult;
+
+/*
+ * One test bench: the TPG it drives, the port its node reports to and how
+ * its valves are wired
+ */
+typedef struct {
+    char* deviceName;
+    int rxPort;
+    char* wiringFile;
+    char* logFile;
+    pid_t pid;
+    int resultFd;
+    RigResult result;
+} Rig;
+
+typedef struct {
+    Rig** rigs;
+    int nRigs;
+} RigCampaign;
+
+Rig* createRig(const char* deviceName, int rxPort, const char* wiringFile, const char* logFile);
+void freeRig(Rig* rig);
+RigCampaign* readRigCampaign(const char* filename);
+void freeRigCampaign(RigCampaign* campaign);
+void printRigResults(RigCampaign* campaign);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAMPAIGN_H */
@@ -8,6 +8,8 @@ extern "C"
 
 #include <libxml/tree.h>
 #include "assertions.h"
+#include "gpio.h"
+#include "hashindex.h"
     
 typedef struct {
     int tpIndex;
@@ -21,20 +23,25 @@ typedef struct {
 typedef struct {
     Wire** wires;
     int nWires;
+    int* wireIndices;
+    int nTps;
     int maxPins;
     Valve** valves;
     int nValves;
+    HashIndex* valveIndices;
+    GpioBackend* gpio;
 } Wiring;
 typedef enum {
     NONE, SA0, SA1
 } CircuitFault;    
 
-void setupWiring();
-void teardownWiring();
+int setupWiring(Wiring* wiring, GpioBackend* gpio);
+void teardownWiring(Wiring* wiring);
 int getIndexOfTPIndexInWiring(Wiring* wiring, int tpIndex);
+int getIndexOfValveInWiring(Wiring* wiring, int valveNo);
 Wiring* createWiringFromXMLNode(AssertionsSet* assertionsSet, xmlNode* wiringNode);
 void freeWiring(Wiring* wiring);
-void setValveFault(Wiring* wiring, int valveNo, CircuitFault fault);
+int setValveFault(Wiring* wiring, int valveNo, CircuitFault fault);
 void printWiring(AssertionsSet* assertionsSet, Wiring* wiring);
 void printValveWiring(Wiring* wiring);
 
@@ -0,0 +1,19 @@
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include "assertions.h"
+#include "program.h"
+
+void writeCircuitSource(FILE* stream, AssertionsSet* set, CircuitProgram* program);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CODEGEN_H */
+
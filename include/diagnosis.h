@@ -0,0 +1,55 @@
+#ifndef DIAGNOSIS_H
+#define DIAGNOSIS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "assertions.h"
+#include "faultsim.h"
+#include "hashindex.h"
+#include "program.h"
+
+#define MAX_DICTIONARY_VECTORS 4096
+
+typedef struct {
+    int* faults;
+    int nFaults;
+} FaultClass;
+
+typedef struct {
+    FaultSimulation* sim;
+    int* vectors;
+    int nVectors;
+    HashIndex* vectorIndices;
+    int tpWords;
+    int syndromeWords;
+    FaultClass* classes;
+    int nClasses;
+    HashIndex* classIndices;
+    int* faultClasses;
+    FaultClass* passFailClasses;
+    int nPassFailClasses;
+    HashIndex* passFailIndices;
+    int* faultPassFailClasses;
+} FaultDictionary;
+
+FaultDictionary* createFaultDictionary(CircuitProgram* program, FaultSimulation* sim, 
+        const int* vectors, int nVectors);
+void freeFaultDictionary(FaultDictionary* dict);
+FaultClass* getFaultClass(FaultDictionary* dict, int valveNo, CircuitFault fault);
+TruthWord* createFailingVectors(FaultDictionary* dict);
+void clearFailingVectors(FaultDictionary* dict, TruthWord* failingVectors);
+int addFailingVector(FaultDictionary* dict, TruthWord* failingVectors, int vector);
+FaultClass* diagnoseFailingVectors(FaultDictionary* dict, TruthWord* failingVectors);
+int isFaultInClass(FaultDictionary* dict, FaultClass* faultClass, int valveNo, CircuitFault fault);
+int areFaultsEquivalent(FaultDictionary* dict, int valveNo1, CircuitFault fault1, 
+        int valveNo2, CircuitFault fault2);
+void printFaultDictionary(FaultDictionary* dict);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DIAGNOSIS_H */
+
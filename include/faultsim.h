@@ -0,0 +1,54 @@
+#ifndef FAULTSIM_H
+#define FAULTSIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "assertions.h"
+#include "circuit.h"
+#include "hashindex.h"
+#include "program.h"
+
+#define FAULTSIM_SAMPLE_VECTORS (1 << 16)
+#define FAULTSIM_SAMPLE_SEED 1
+#define FAULTSIM_MAX_SAMPLE_INPUTS PROGRAM_MAX_INPUTS
+
+typedef struct {
+    int valveNo;
+    CircuitFault fault;
+    TruthWord* detectingVectors;
+    int nDetectingVectors;
+} FaultResponse;
+
+/*
+ * Detecting vectors are recorded by their index in vectors, or by the vector
+ * itself when every vector was simulated and vectors is NULL
+ */
+typedef struct {
+    FaultResponse* responses;
+    int nResponses;
+    HashIndex* valveIndices;
+    int* vectors;
+    HashIndex* vectorIndices;
+    int nVectors;
+    int nWords;
+} FaultSimulation;
+
+FaultSimulation* simulateValveFaultsOnVectors(CircuitProgram* program, Wiring* wiring, 
+        const int* vectors, int nVectors);
+FaultSimulation* simulateValveFaults(CircuitProgram* program, Wiring* wiring);
+FaultSimulation* simulateSampledValveFaults(CircuitProgram* program, Wiring* wiring, int nVectors);
+void freeFaultSimulation(FaultSimulation* sim);
+FaultResponse* getFaultResponse(FaultSimulation* sim, int valveNo, CircuitFault fault);
+int getSimulatedVector(FaultSimulation* sim, int index);
+int isDetectingVectorIndex(FaultResponse* response, int index);
+int isDetectingVector(FaultSimulation* sim, FaultResponse* response, int vector);
+void printFaultSimulation(FaultSimulation* sim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FAULTSIM_H */
+
@@ -0,0 +1,61 @@
+#ifndef GPIO_H
+#define GPIO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define GPIO_BACKEND_WIRINGPI_NAME "wiringpi"
+#define GPIO_BACKEND_GPIOCHAR_NAME "gpiochar"
+#define GPIO_BACKEND_MOCK_NAME "mock"
+#ifdef GPIO_WIRINGPI
+#define GPIO_BACKEND_DEFAULT_NAME GPIO_BACKEND_WIRINGPI_NAME
+#else
+#define GPIO_BACKEND_DEFAULT_NAME GPIO_BACKEND_GPIOCHAR_NAME
+#endif
+#define GPIO_CHIP_DEVICE "/dev/gpiochip0"
+#define GPIO_CONSUMER_NAME "edsac_status_tester"
+#define GPIO_HEADER_PINS 40
+
+typedef enum {
+    GPIO_BACKEND_WIRINGPI, GPIO_BACKEND_GPIOCHAR, GPIO_BACKEND_MOCK
+} GpioBackendType;
+
+typedef struct GpioBackend GpioBackend;
+
+/*
+ * Drives a fixed set of output lines, requested once and then always written
+ * together. Each implementation sets as many of them per call as it can:
+ * gpiochar up to 64 in one ioctl, wiringPi one at a time but only those that
+ * changed, and the mock only records the levels
+ */
+struct GpioBackend {
+    GpioBackendType type;
+    int (*requestOutputs)(GpioBackend* gpio);
+    int (*writeOutputs)(GpioBackend* gpio);
+    void (*release)(GpioBackend* gpio);
+    int* pins;
+    uint8_t* levels;
+    uint8_t* written;
+    int nPins;
+    int chipFd;
+    int* lineFds;
+    int nLineFds;
+    int nWrites;
+};
+
+int getGpioOfHeaderPin(int pin);
+int getGpioBackendByName(const char* name, GpioBackendType* type);
+GpioBackend* createGpioBackend(GpioBackendType type, const char* chip);
+void freeGpioBackend(GpioBackend* gpio);
+int requestGpioOutputs(GpioBackend* gpio, const int* pins, int nPins);
+void setGpioOutput(GpioBackend* gpio, int index, int level);
+int writeGpioOutputs(GpioBackend* gpio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GPIO_H */
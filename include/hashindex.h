@@ -0,0 +1,32 @@
+#ifndef HASHINDEX_H
+#define HASHINDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    unsigned char** keys;
+    int* keyLens;
+    unsigned int* hashes;
+    int* values;
+    int capacity;
+    int n;
+} HashIndex;
+
+unsigned int getHashOfBytes(const void* key, int keyLen);
+HashIndex* createHashIndex(int expectedSize);
+void freeHashIndex(HashIndex* index);
+int hashIndexPut(HashIndex* index, const void* key, int keyLen, int value);
+int hashIndexGet(HashIndex* index, const void* key, int keyLen);
+int hashIndexPutStr(HashIndex* index, const char* key, int value);
+int hashIndexGetStr(HashIndex* index, const char* key);
+int hashIndexPutInt(HashIndex* index, int key, int value);
+int hashIndexGetInt(HashIndex* index, int key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HASHINDEX_H */
+
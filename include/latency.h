@@ -0,0 +1,52 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include "circuit.h"
+#include "hashindex.h"
+
+/*
+ * Latencies are recorded in microseconds into log-linear buckets, HDR
+ * histogram style. Values below 2^LATENCY_SUB_BUCKET_BITS are exact, larger
+ * ones keep LATENCY_SUB_BUCKET_BITS - 1 significant bits
+ */
+#define LATENCY_SUB_BUCKET_BITS 8
+#define LATENCY_MAX_BITS 40
+
+typedef struct {
+    uint64_t* counts;
+    int nBuckets;
+    uint64_t total;
+    int64_t min;
+    int64_t max;
+} LatencyHistogram;
+
+typedef struct {
+    LatencyHistogram** histograms;
+    int* valveNos;
+    CircuitFault* faults;
+    int n;
+    HashIndex* indices;
+    LatencyHistogram* faultHistograms[SA1 + 1];
+} LatencyHistograms;
+
+LatencyHistogram* createLatencyHistogram();
+void freeLatencyHistogram(LatencyHistogram* histogram);
+void recordLatency(LatencyHistogram* histogram, int64_t latencyUs);
+int64_t getLatencyPercentile(LatencyHistogram* histogram, double percentile);
+LatencyHistograms* createLatencyHistograms();
+void freeLatencyHistograms(LatencyHistograms* histograms);
+void recordValveLatency(LatencyHistograms* histograms, int valveNo, CircuitFault fault, int64_t latencyUs);
+void printLatencyHistograms(LatencyHistograms* histograms);
+int writeLatencyHistograms(const char* filename, LatencyHistograms* histograms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LATENCY_H */
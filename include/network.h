@@ -5,19 +5,65 @@
 extern "C" {
 #endif
     
+#include <pthread.h>
+#include <time.h>
 #include "edsac_representation.h"
 
 #define MAX_MSG_STR_LENGTH 200
+#define NETWORK_POLL_INTERVAL_US 500
+#define NETWORK_POLL_MAX_INTERVAL_US 4000
+#define RELAY_QUEUE_SIZE 256
+#define RELAY_BATCH_SIZE 32
 
+typedef struct NetworkQueueItem NetworkQueueItem;
+
+struct NetworkQueueItem {
+    BufferItem* item;
+    struct timespec received;
+    NetworkQueueItem* next;
+};
+
+/*
+ * The server only offers a non-blocking read, so a pump thread polls it,
+ * backing off while it is idle unless listening, and queues what arrives, waking any waiting
+ * reader through eventFd. Messages to relay go the other way through a
+ * bounded queue drained in batches by a sender thread, and are dropped
+ * rather than waited on when it is full
+ */
 typedef struct {
     int server;
     int sending;
+    pthread_t pump;
+    int pumping;
+    int listening;
+    pthread_mutex_t queueLock;
+    NetworkQueueItem* queueHead;
+    NetworkQueueItem* queueTail;
+    int eventFd;
+    int timerFd;
+    int epollFd;
+    pthread_t relay;
+    int relaying;
+    pthread_mutex_t relayLock;
+    pthread_cond_t relayReady;
+    Message* relayQueue[RELAY_QUEUE_SIZE];
+    int relayQueueOwned[RELAY_QUEUE_SIZE];
+    int relayHead;
+    int relayCount;
+    int nRelayed;
+    int nRelayDropped;
+    int nRelayFailed;
 } NetworkHandle;
 
 NetworkHandle* setupNetwork(const char* rxAddrStr, int rxPort, 
         const char* txAddrStr, int txPort);
-Message* readNetworkMessage(NetworkHandle* network, time_t since);
+void setNetworkListening(NetworkHandle* network, int listening);
+Message* readNetworkMessage(NetworkHandle* network, time_t since, struct timespec* received);
+Message* waitForNetworkMessage(NetworkHandle* network, time_t since, const struct timespec* deadline, 
+        struct timespec* received);
 int resendNetworkMessage(NetworkHandle* network, const Message* msg);
+int relayNetworkMessage(NetworkHandle* network, Message* msg, int owned);
+void printRelayStatistics(NetworkHandle* network);
 void teardownNetwork(NetworkHandle* network);
 
 #ifdef __cplusplus
@@ -0,0 +1,66 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <libxml/tree.h>
+#include "assertions.h"
+
+#define PROGRAM_BLOCK_WORDS 4
+#define PROGRAM_BLOCK_VECTORS (PROGRAM_BLOCK_WORDS * TRUTH_WORD_BITS)
+/* Vectors are numbered with ints, and sweeps count 1 << nInputs of them */
+#define PROGRAM_MAX_INPUTS 30
+#define COMPILED_CIRCUIT_FUNCTION "evaluateCircuit"
+#define COMPILED_CIRCUIT_HASH "circuitHash"
+
+typedef enum {
+    INSTR_AND, INSTR_OR, INSTR_NOT
+} InstructionOp;
+
+typedef struct {
+    InstructionOp op;
+    int dst;
+    int a;
+    int b;
+    int valveNo;
+} Instruction;
+
+typedef void (*CompiledCircuitFunction)(TruthWord* registers, int nWords);
+
+typedef struct {
+    Instruction* instructions;
+    int nInstructions;
+    int* levelStarts;
+    int nLevels;
+    int nRegisters;
+    int nInputs;
+    int* tpRegisters;
+    int nTps;
+    void* compiledLibrary;
+    CompiledCircuitFunction compiled;
+} CircuitProgram;
+
+CircuitProgram* compileCircuitProgram(xmlNode* circuitNode, AssertionsSet* set);
+void freeCircuitProgram(CircuitProgram* program);
+unsigned int getCircuitProgramHash(CircuitProgram* program);
+int loadCompiledCircuit(CircuitProgram* program, const char* path);
+TruthWord* createProgramRegisters(CircuitProgram* program);
+void setProgramInputsForVectors(CircuitProgram* program, TruthWord* registers, uint64_t firstVector);
+void setProgramInputsForVectorList(CircuitProgram* program, TruthWord* registers, const int* vectors, int nVectors);
+void runCircuitProgram(CircuitProgram* program, TruthWord* registers);
+void runCircuitProgramWithFault(CircuitProgram* program, TruthWord* registers, int valveNo, int stuckAt);
+int getProgramOutput(CircuitProgram* program, TruthWord* registers, int tpIndex, int lane);
+void checkSamplesWithProgram(CircuitProgram* program, TruthWord* registers, int* samples, int nVectors, 
+        int* dest, int* n);
+void printProgramTruthTable(CircuitProgram* program, AssertionsSet* set);
+void printProgram(CircuitProgram* program);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROGRAM_H */
+
@@ -12,14 +12,59 @@ typedef struct {
     int fd;
 } SerialHandle;
 
+/*
+ * Binary frames are SERIAL_FRAME_SYNC, a little endian 16 bit sequence
+ * number, the number of payload bytes, the pin levels packed eight to a byte
+ * with pin 0 in the lowest bit of the first, then a CRC-8 of everything
+ * after the sync byte
+ */
+#define SERIAL_FRAME_SYNC 0xA5
+#define SERIAL_FRAME_HEADER_LEN 4
+#define SERIAL_FRAME_CHECKSUM_LEN 1
+#define SERIAL_FRAME_SEQ_MASK 0xFFFF
+/* A start and a stop bit frame each byte on the line */
+#define SERIAL_BITS_PER_BYTE 10
+#define SERIAL_PROTOCOL_ASCII_NAME "ascii"
+#define SERIAL_PROTOCOL_BINARY_NAME "binary"
+#define SERIAL_SWEEP_MAX_INPUTS 30
+#define SERIAL_SWEEP_MAX_RENDERED_FRAMES (1 << MAX_TRUTH_TABLE_INPUTS)
+/* At least as many frames as the serial writer can hold queued */
+#define SERIAL_SWEEP_WINDOW_FRAMES 4096
+
+typedef enum {
+    SERIAL_PROTOCOL_ASCII, SERIAL_PROTOCOL_BINARY
+} SerialProtocol;
+
+typedef struct {
+    SerialProtocol protocol;
+    char* frames;
+    int frameLen;
+    int nRendered;
+    int* vectors;
+    int nFrames;
+    int grayCode;
+    int* pins;
+    int nPins;
+    int nInputs;
+} SerialSweep;
+
 SerialHandle* setupSerial(const char* device, int baud);
 void teardownSerial(SerialHandle* serial);
 void writeSerialStr(SerialHandle* serial);
-void writeSerial(SerialHandle* serial, AssertionsSet* set, Wiring* wiring, int n);
+int getSerialProtocolByName(const char* name, SerialProtocol* protocol);
+int* createSerialPinTable(AssertionsSet* set, Wiring* wiring);
+SerialSweep* createSerialSweep(AssertionsSet* set, Wiring* wiring, const int* vectors, 
+        int nVectors, int grayCode, SerialProtocol protocol);
+void freeSerialSweep(SerialSweep* sweep);
+int getSerialSweepVector(SerialSweep* sweep, int frame);
+const char* getSerialSweepFrame(SerialSweep* sweep, int frame);
+int getSerialFrameMs(SerialSweep* sweep, int baud);
+void writeSerialFrame(SerialHandle* serial, SerialSweep* sweep, int frame);
+int readSerialFrame(SerialProtocol protocol, const char* bytes, int n, int nPins, const int* pins, 
+        int nInputs, int* vector, int* seq);
     
 #ifdef __cplusplus
 }
 #endif
 
 #endif /* SERIAL_H */
-
@@ -0,0 +1,69 @@
+#ifndef SERIALWRITER_H
+#define SERIALWRITER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+#include <time.h>
+#include "serial.h"
+
+#define SERIAL_WRITER_RING_SIZE 1024
+#define SERIAL_ACK_SYNC 0x5A
+#define SERIAL_ACK_LEN 3
+#define SERIAL_ACK_TIMEOUT_MS 100
+#define SERIAL_ACK_RETRIES 3
+
+typedef struct {
+    const char* bytes;
+    int len;
+    int frame;
+} QueuedFrame;
+
+typedef struct {
+    int frame;
+    struct timespec scheduled;
+    struct timespec emitted;
+    struct timespec acknowledged;
+    int acked;
+} EmittedFrame;
+
+/*
+ * The queue and emitted rings each have a single producer and consumer.
+ * Frames go from the main thread to the writer on the queue ring, and their
+ * timestamps come back on the emitted ring. With an ack window, up to that
+ * many frames are sent ahead of the TPG echoing their sequence numbers back
+ * as SERIAL_ACK_SYNC and the little endian sequence number, and a frame is
+ * only reported once acknowledged or given up on
+ */
+typedef struct {
+    SerialHandle* serial;
+    long periodNs;
+    int ackWindow;
+    int timerFd;
+    int wakeFd;
+    int reportFd;
+    pthread_t thread;
+    QueuedFrame queue[SERIAL_WRITER_RING_SIZE];
+    EmittedFrame emitted[SERIAL_WRITER_RING_SIZE];
+    EmittedFrame inFlight[SERIAL_WRITER_RING_SIZE];
+    int retries[SERIAL_WRITER_RING_SIZE];
+    unsigned int queueHead;
+    unsigned int queueTail;
+    unsigned int emittedHead;
+    unsigned int emittedTail;
+    int stopping;
+} SerialWriter;
+
+SerialWriter* createSerialWriter(SerialHandle* serial, int periodMs, int ackWindow);
+void freeSerialWriter(SerialWriter* writer);
+void setSerialWriterPeriod(SerialWriter* writer, int periodMs);
+int queueSerialFrame(SerialWriter* writer, SerialSweep* sweep, int frame);
+int readEmittedFrame(SerialWriter* writer, EmittedFrame* dest, int block);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SERIALWRITER_H */
@@ -0,0 +1,21 @@
+#ifndef TIMEUTIL_H
+#define TIMEUTIL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <time.h>
+
+#define NS_PER_S 1000000000L
+#define NS_PER_MS 1000000L
+
+void addTimespecNs(struct timespec* t, long ns);
+int compareTimespecs(const struct timespec* a, const struct timespec* b);
+double getTimespecDiffMs(const struct timespec* end, const struct timespec* start);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMEUTIL_H */
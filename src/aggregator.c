@@ -0,0 +1,155 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aggregator.h"
+#include "edsac_representation.h"
+#include "hashindex.h"
+#include "network.h"
+#include "timeutil.h"
+
+const char* getMessageTypeName(MessageType type) {
+    switch(type) {
+        case HARD_ERROR_VALVE:
+            return "hardware valve";
+        case HARD_ERROR_OTHER:
+            return "hardware other";
+        case SOFT_ERROR:
+            return "software";
+        case KEEP_ALIVE:
+            return "keep alive";
+        case INVALID:
+        default:
+            return "unknown";
+    }
+}
+
+/*
+ * Returns the text a message carries, or NULL for keep alives and invalid ones
+ */
+const char* getMessageText(const Message* msg) {
+    switch(msg->type) {
+        case HARD_ERROR_VALVE:
+            return msg->data.hardware_valve.message;
+        case HARD_ERROR_OTHER:
+            return msg->data.hardware_other.message;
+        case SOFT_ERROR:
+            return msg->data.software.message;
+        case KEEP_ALIVE:
+        case INVALID:
+        default:
+            return NULL;
+    }
+}
+
+MessageAggregator* createMessageAggregator(int windowMs) {
+    MessageAggregator* aggregator = malloc(sizeof(MessageAggregator));
+    aggregator->entries = NULL;
+    aggregator->n = 0;
+    aggregator->indices = createHashIndex(0);
+    aggregator->windowMs = windowMs;
+    return aggregator;
+}
+
+void freeMessageAggregator(MessageAggregator* aggregator) {
+    int i;
+    if(aggregator != NULL) {
+        for(i = 0; i < aggregator->n; i++) {
+            free_message(aggregator->entries[i].sample);
+        }
+        free(aggregator->entries);
+        freeHashIndex(aggregator->indices);
+        free(aggregator);
+    }
+}
+
+/*
+ * The first message of each kind in the window is kept as a sample. Valve
+ * reports are relayed as a new message noting how often they occurred, as
+ * the library can only allocate those; other kinds relay the sample itself.
+ * Either way the sample is freed
+ */
+void relayAggregatedMessage(NetworkHandle* net, AggregatedMessage* entry) {
+    char text[AGGREGATED_MSG_LEN];
+    Message* summary;
+    if(entry->type == HARD_ERROR_VALVE && entry->count > 1) {
+        snprintf(text, sizeof(text), "Reported %d times over %.3fms", entry->count, 
+                getTimespecDiffMs(&entry->last, &entry->first));
+        summary = alloc_hard_error_valve(entry->valveNo, text);
+        if(summary != NULL) {
+            relayNetworkMessage(net, summary, true);
+            free_message(entry->sample);
+            return;
+        }
+    }
+    relayNetworkMessage(net, entry->sample, true);
+}
+
+void flushMessageAggregator(MessageAggregator* aggregator, NetworkHandle* net) {
+    AggregatedMessage* entry;
+    const char* text;
+    int i;
+    for(i = 0; i < aggregator->n; i++) {
+        entry = &aggregator->entries[i];
+        if(entry->valveNo >= 0) {
+            printf("%d %s messages for valve %d", entry->count, getMessageTypeName(entry->type), entry->valveNo);
+        } else {
+            printf("%d %s messages", entry->count, getMessageTypeName(entry->type));
+        }
+        printf(" over %.3fms", getTimespecDiffMs(&entry->last, &entry->first));
+        // The text of the first message of each kind stands for the rest
+        text = getMessageText(entry->sample);
+        if(text != NULL && text[0] != '\0') {
+            printf(": %s", text);
+        }
+        printf("\n");
+        if(entry->relay && net != NULL && net->sending) {
+            relayAggregatedMessage(net, entry);
+        } else {
+            free_message(entry->sample);
+        }
+    }
+    aggregator->n = 0;
+    freeHashIndex(aggregator->indices);
+    aggregator->indices = createHashIndex(0);
+}
+
+/*
+ * Messages that will not be relayed are still aggregated so that they are
+ * only printed once per window, but apart from relayed ones of the same kind
+ * so that neither decides whether the other is relayed. The aggregator takes
+ * ownership of msg
+ */
+void aggregateMessage(MessageAggregator* aggregator, NetworkHandle* net, Message* msg, 
+        const struct timespec* received, int relay) {
+    AggregatedMessage* entry;
+    int key[3], i;
+    if(aggregator->n > 0 && getTimespecDiffMs(received, &aggregator->windowStart) >= aggregator->windowMs) {
+        flushMessageAggregator(aggregator, net);
+    }
+    if(aggregator->n == 0) {
+        aggregator->windowStart = *received;
+    }
+    key[0] = msg->type;
+    key[1] = msg->type == HARD_ERROR_VALVE ? (int) msg->data.hardware_valve.valve_no : -1;
+    key[2] = relay != 0;
+    i = hashIndexGet(aggregator->indices, key, sizeof(key));
+    if(i < 0) {
+        i = aggregator->n++;
+        aggregator->entries = realloc(aggregator->entries, aggregator->n * sizeof(AggregatedMessage));
+        entry = &aggregator->entries[i];
+        entry->type = msg->type;
+        entry->valveNo = key[1];
+        entry->count = 0;
+        entry->relay = relay;
+        entry->first = *received;
+        entry->sample = msg;
+        hashIndexPut(aggregator->indices, key, sizeof(key), i);
+    }
+    entry = &aggregator->entries[i];
+    entry->count++;
+    entry->last = *received;
+    if(entry->sample != msg) {
+        free_message(msg);
+    }
+}
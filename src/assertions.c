@@ -3,9 +3,12 @@
 #include <math.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <libxml/tree.h>
 #include <libxml/xmlstring.h>
 #include "assertions.h"
+#include "bdd.h"
 #include "xmlutil.h"
 #include "tables.h"
     
@@ -23,9 +26,12 @@
 #define OP_AND 1
 #define OP_OR 2
 #define OP_NOT 3
+#define NODE_UNLEVELLED -1
+#define NODE_LEVELLING -2
 
 #define YES_STR "Yes"
 #define NO_STR "No"
+#define BDD_TRUTH_TABLE_MESSAGE "Truth table not shown: %d inputs are evaluated as BDDs\n"
 #define TRUTH_TABLE_TITLE "Truth Table"
 #define TP_TABLE_TITLE "Test Points"
 #define TP_TABLE_HEADER_TP "TP";
@@ -38,69 +44,205 @@ NodeIdMap* createNodeIdMap() {
     NodeIdMap* map = malloc(sizeof(NodeIdMap));
     map->inputTpNodes = NULL;
     map->nInputs = 0;
+    map->inputIndices = createHashIndex(0);
     map->nodes = NULL;
-    map->n;
+    map->evaluations = NULL;
+    map->n = 0;
+    map->idIndices = createHashIndex(0);
+    map->bdd = NULL;
     return map;
 };
 
-void addNodeToIdMap(NodeIdMap* map, xmlNode* node) {
+int addNodeToIdMap(NodeIdMap* map, xmlNode* node) {
+    xmlChar* id = xmlGetProp(node, ATTR_NAME_ID);
+    if(!hashIndexPutStr(map->idIndices, id, map->n)) {
+        fprintf(stderr, "Node id \"%s\" is used more than once\n", id);
+    }
+    xmlFree(id);
     map->nodes = realloc(map->nodes, (map->n + 1) * sizeof(xmlNode*));
     map->nodes[map->n] = node;
-    map->n++;
+    map->evaluations = realloc(map->evaluations, (map->n + 1) * sizeof(NodeEvaluation));
+    map->evaluations[map->n].state = NODE_UNEVALUATED;
+    map->evaluations[map->n].truth = NULL;
+    map->evaluations[map->n].sharedTruth = 0;
+    map->evaluations[map->n].bdd = BDD_INVALID;
+    map->evaluations[map->n].depth = 0;
+    map->evaluations[map->n].valveNo = -1;
+    return map->n++;
 }
 
-xmlNode* findNodeInMap(NodeIdMap* map, char* id) {
-    int i;
-    for(i = 0; i < map->n; i++) {
-        if(nodePropEqual(map->nodes[i], ATTR_NAME_ID, id)) {
-            return map->nodes[i];
-        }
+int findNodeIndexInMap(NodeIdMap* map, char* id) {
+    int i = hashIndexGetStr(map->idIndices, id);
+    if(i < 0) {
+        fprintf(stderr, "No such node id found \"%s\"\n", id);
     }
-    fprintf(stderr, "No such node id found \"%s\"\n", id);
-    return NULL;
+    return i;
 }
 
 void addInputNodeToIdMap(NodeIdMap* map, xmlNode* node) {
-    map->inputTpNodes = realloc(map->inputTpNodes, (map->nInputs + 1) * sizeof(char*));
+    map->inputTpNodes = realloc(map->inputTpNodes, (map->nInputs + 1) * sizeof(xmlNode*));
     map->inputTpNodes[map->nInputs] = node;
+    hashIndexPut(map->inputIndices, &node, sizeof(xmlNode*), map->nInputs);
     map->nInputs++;
 }
 
 int findInputIndexInMap(NodeIdMap* map, xmlNode* node) {
-    int i;
-    for(i = 0; i < map->nInputs; i++) {
-        if(map->inputTpNodes[i] == node) {
-            return i;
-        }
+    int i = hashIndexGet(map->inputIndices, &node, sizeof(xmlNode*));
+    if(i < 0) {
+        fprintf(stderr, "No such input found\n");
     }
-    fprintf(stderr, "No such input found\n");
-    return -1;
+    return i;
 }
 
 void freeNodeIdMap(NodeIdMap* map) {
+    int i;
     if(map != NULL) {
+        for(i = 0; i < map->n; i++) {
+            if(!map->evaluations[i].sharedTruth) {
+                free(map->evaluations[i].truth);
+            }
+        }
         free(map->inputTpNodes);
+        freeHashIndex(map->inputIndices);
         free(map->nodes);
+        free(map->evaluations);
+        freeHashIndex(map->idIndices);
         free(map);
     }
 }
 
+int getIndexOfTPNameInSet(AssertionsSet* set, const char* tpName) {
+    return hashIndexGetStr(set->tpIndices, tpName);
+}
+
 int getIndexOfTPNodeInSet(AssertionsSet* set, xmlNode* node) {
     int i;
-    for(i = 0; i < set->nTp; i++) {
-        if(nodePropEqual(node, ATTR_NAME_ID, set->tps[i]->tpName)) {
-            return i;
+    xmlChar* id = xmlGetProp(node, ATTR_NAME_ID);
+    if(id == NULL) {
+        return -1;
+    }
+    i = getIndexOfTPNameInSet(set, id);
+    xmlFree(id);
+    return i;
+}
+
+int getTruthTableWords(int nInputs) {
+    return ((1 << nInputs) + TRUTH_WORD_BITS - 1) / TRUTH_WORD_BITS;
+}
+
+int getTruthTableValue(const TruthWord* truth, int row) {
+    return (truth[row / TRUTH_WORD_BITS] >> (row % TRUTH_WORD_BITS)) & 1;
+}
+
+void maskTruthTable(TruthWord* truth, int nInputs) {
+    if((1 << nInputs) < TRUTH_WORD_BITS) {
+        truth[0] &= (((TruthWord) 1) << (1 << nInputs)) - 1;
+    }
+}
+
+TruthWord* createInputTruthTable(int nInputs, int inputIndex) {
+    int i, nWords = getTruthTableWords(nInputs);
+    TruthWord* truth;
+    TruthWord pattern = 0;
+    assert((truth = malloc(nWords * sizeof(TruthWord))) != NULL);
+    if((1 << inputIndex) < TRUTH_WORD_BITS) {
+        for(i = 0; i < TRUTH_WORD_BITS; i++) {
+            if(i & (1 << inputIndex)) {
+                pattern |= ((TruthWord) 1) << i;
+            }
+        }
+        for(i = 0; i < nWords; i++) {
+            truth[i] = pattern;
+        }
+    } else {
+        for(i = 0; i < nWords; i++) {
+            truth[i] = (i * TRUTH_WORD_BITS) & (1 << inputIndex) ? ~((TruthWord) 0) : 0;
         }
     }
+    maskTruthTable(truth, nInputs);
+    return truth;
+}
+
+TruthWord* copyTruthTable(const TruthWord* truth, int nInputs) {
+    int nWords = getTruthTableWords(nInputs);
+    TruthWord* copy;
+    assert((copy = malloc(nWords * sizeof(TruthWord))) != NULL);
+    memcpy(copy, truth, nWords * sizeof(TruthWord));
+    return copy;
+}
+
+int getOperatorOfNode(xmlNode* node) {
+    if(strEqual(node->name, NODE_NAME_AND)) {
+        return OP_AND;
+    } else if(strEqual(node->name, NODE_NAME_OR)) {
+        return OP_OR;
+    } else if(strEqual(node->name, NODE_NAME_NOT)) {
+        return OP_NOT;
+    }
     return -1;
 }
 
-int* parseNode(xmlNode* node, NodeIdMap* map, int* depthOut, int* valveNoOut) {
+TruthWord* parseNode(xmlNode* node, NodeIdMap* map, int* depthOut, int* valveNoOut, int* sharedOut);
+
+BddRef parseNodeBdd(xmlNode* node, NodeIdMap* map, int* depthOut, int* valveNoOut);
+
+/*
+ * Evaluates a node with an id at most once per load, as a truth table or as a
+ * BDD depending on the width of the circuit
+ */
+int evaluateMappedNode(NodeIdMap* map, int index) {
+    NodeEvaluation* eval = &map->evaluations[index];
+    xmlChar* id;
+    if(eval->state == NODE_EVALUATING) {
+        id = xmlGetProp(map->nodes[index], ATTR_NAME_ID);
+        fprintf(stderr, "Node \"%s\" refers to itself\n", id);
+        xmlFree(id);
+        return -1;
+    }
+    if(eval->state == NODE_UNEVALUATED) {
+        eval->state = NODE_EVALUATING;
+        if(map->bdd != NULL) {
+            eval->bdd = parseNodeBdd(map->nodes[index], map, &eval->depth, &eval->valveNo);
+        } else {
+            eval->truth = parseNode(map->nodes[index], map, &eval->depth, &eval->valveNo, &eval->sharedTruth);
+        }
+        if(eval->truth == NULL && eval->bdd == BDD_INVALID) {
+            eval->state = NODE_UNEVALUATED;
+            return -1;
+        }
+        eval->state = NODE_EVALUATED;
+    }
+    return 0;
+}
+
+/*
+ * The cached table stays owned by the cache and is handed out shared, so a
+ * subcircuit referred to many times is only stored once
+ */
+TruthWord* parseMappedNode(NodeIdMap* map, int index, int* depthOut, int* valveNoOut) {
+    NodeEvaluation* eval = &map->evaluations[index];
+    if(evaluateMappedNode(map, index) < 0) {
+        return NULL;
+    }
+    *depthOut = eval->depth;
+    if(valveNoOut != NULL) {
+        *valveNoOut = eval->valveNo;
+    }
+    return eval->truth;
+}
+
+/*
+ * sharedOut is set when the table returned belongs to the cache, in which
+ * case it must not be changed or freed. Operators only copy a shared table
+ * when they need to build on it
+ */
+TruthWord* parseNode(xmlNode* node, NodeIdMap* map, int* depthOut, int* valveNoOut, int* sharedOut) {
     xmlNode* child = node->children;
     xmlChar* contents = NULL;
-    int i, op = -1, inputIndex;
-    int* truth = NULL; 
-    int* truth2 = NULL;
+    int i, op = -1, inputIndex, nodeIndex, nWords = getTruthTableWords(map->nInputs);
+    int shared, shared2;
+    TruthWord* truth = NULL; 
+    TruthWord* truth2 = NULL;
     int depth1, depth2;
     /*if(xmlHasProp(node, ATTR_NAME_ID)) {
         contents = xmlGetProp(node, ATTR_NAME_ID);
@@ -109,22 +251,19 @@ int* parseNode(xmlNode* node, NodeIdMap* map, int* depthOut, int* valveNoOut) {
     } else {
         printf("parseNode(%s)\n", node->name);
     }*/
+    *sharedOut = 0;
     if(strEqual(node->name, NODE_NAME_REF)) {
         contents = xmlNodeListGetString(node->doc, node->children, 1);
-        truth = parseNode(findNodeInMap(map, contents), map, depthOut, valveNoOut);
-        assert(truth != NULL);
+        nodeIndex = findNodeIndexInMap(map, contents);
         xmlFree(contents);
-        return truth;
-    } else if(strEqual(node->name, NODE_NAME_AND) || strEqual(node->name, NODE_NAME_OR) || 
-            strEqual(node->name, NODE_NAME_NOT)) {
-        
-        if(strEqual(node->name, NODE_NAME_AND)) {
-            op = OP_AND;
-        } else if(strEqual(node->name, NODE_NAME_OR)) {
-            op = OP_OR;
-        } else if(strEqual(node->name, NODE_NAME_NOT)) {
-            op = OP_NOT;
+        if(nodeIndex < 0) {
+            return NULL;
         }
+        truth = parseMappedNode(map, nodeIndex, depthOut, valveNoOut);
+        assert(truth != NULL);
+        *sharedOut = 1;
+        return truth;
+    } else if((op = getOperatorOfNode(node)) > 0) {
         if(!xmlHasProp(node, ATTR_NAME_VALVE_NO)) {
             fprintf(stderr, "%s node has no valveNo\n", node->name);
             return NULL;
@@ -133,30 +272,43 @@ int* parseNode(xmlNode* node, NodeIdMap* map, int* depthOut, int* valveNoOut) {
             child = child->next;
         }
         if(child) {
-            truth = parseNode(child, map, &depth1, NULL);
+            truth = parseNode(child, map, &depth1, NULL, &shared);
             assert(truth != NULL);
             if(op == OP_NOT) {
-                for(i = 0; i < (1 << map->nInputs); i++) {
-                    truth[i] = !truth[i];
+                if(shared) {
+                    truth = copyTruthTable(truth, map->nInputs);
+                    shared = 0;
                 }
+                for(i = 0; i < nWords; i++) {
+                    truth[i] = ~truth[i];
+                }
+                maskTruthTable(truth, map->nInputs);
             }
             child = child->next;
             while(child) {
                 if(child->type == XML_ELEMENT_NODE) {
-                    truth2 = parseNode(child, map, &depth2, NULL);
+                    if(op == OP_NOT) {
+                        fprintf(stderr, "Not operator can only have one param\n");
+                        free(truth);
+                        return NULL;
+                    }
+                    truth2 = parseNode(child, map, &depth2, NULL, &shared2);
                     assert(truth2 != NULL);
                     depth1 = fmax(depth1, depth2);
-                    for(i = 0; i < (1 << map->nInputs); i++) {
+                    if(shared) {
+                        truth = copyTruthTable(truth, map->nInputs);
+                        shared = 0;
+                    }
+                    for(i = 0; i < nWords; i++) {
                         if(op == OP_AND) {
-                            truth[i] = truth[i] && truth2[i];
+                            truth[i] &= truth2[i];
                         } else if(op == OP_OR) {
-                            truth[i] = truth[i] || truth2[i];
-                        } else if(op == OP_NOT) {
-                            fprintf(stderr, "Not operator can only have one param\n");
-                            return NULL;
+                            truth[i] |= truth2[i];
                         }
                     }
-                    free(truth2);
+                    if(!shared2) {
+                        free(truth2);
+                    }
                 }
                 child = child->next;
             }
@@ -166,6 +318,7 @@ int* parseNode(xmlNode* node, NodeIdMap* map, int* depthOut, int* valveNoOut) {
                 xmlFree(contents);
             }
             *depthOut = depth1 + 1;
+            *sharedOut = shared;
             return truth;
         } else {
             fprintf(stderr, "Operator node has no params\n");
@@ -174,7 +327,7 @@ int* parseNode(xmlNode* node, NodeIdMap* map, int* depthOut, int* valveNoOut) {
     } else if(strEqual(node->name, NODE_NAME_TP)) {
         while(child) {
             if(child->type == XML_ELEMENT_NODE) {
-                truth = parseNode(child, map, depthOut, valveNoOut);
+                truth = parseNode(child, map, depthOut, valveNoOut, sharedOut);
                 assert(truth != NULL);
                 return truth;
             }
@@ -185,10 +338,7 @@ int* parseNode(xmlNode* node, NodeIdMap* map, int* depthOut, int* valveNoOut) {
             fprintf(stderr, "TP has no child nodes but isn't an indexed input\n");
             return NULL;
         }
-        truth = malloc((1 << map->nInputs) * sizeof(int));
-        for(i = 0; i < (1 << map->nInputs); i++) {
-            truth[i] = (i & (1 << inputIndex)) != 0;
-        }
+        truth = createInputTruthTable(map->nInputs, inputIndex);
         *depthOut = 0;
         if(valveNoOut != NULL) {
             *valveNoOut = -1;
@@ -200,7 +350,198 @@ int* parseNode(xmlNode* node, NodeIdMap* map, int* depthOut, int* valveNoOut) {
     }
 }
 
-TestPoint* createTestPointFromXMLNode(xmlNode* tpNode, int* truthTable, int valveNo) {
+/*
+ * As parseMappedNode, but for circuits too wide for truth tables. BDD nodes
+ * are shared by the manager, so the cached reference is returned directly
+ */
+BddRef parseMappedNodeBdd(NodeIdMap* map, int index, int* depthOut, int* valveNoOut) {
+    NodeEvaluation* eval = &map->evaluations[index];
+    if(evaluateMappedNode(map, index) < 0) {
+        return BDD_INVALID;
+    }
+    *depthOut = eval->depth;
+    if(valveNoOut != NULL) {
+        *valveNoOut = eval->valveNo;
+    }
+    return eval->bdd;
+}
+
+BddRef parseNodeBdd(xmlNode* node, NodeIdMap* map, int* depthOut, int* valveNoOut) {
+    xmlNode* child = node->children;
+    xmlChar* contents = NULL;
+    int op, inputIndex, nodeIndex;
+    BddRef bdd, bdd2;
+    int depth1, depth2;
+    if(strEqual(node->name, NODE_NAME_REF)) {
+        contents = xmlNodeListGetString(node->doc, node->children, 1);
+        nodeIndex = findNodeIndexInMap(map, contents);
+        xmlFree(contents);
+        if(nodeIndex < 0) {
+            return BDD_INVALID;
+        }
+        bdd = parseMappedNodeBdd(map, nodeIndex, depthOut, valveNoOut);
+        assert(bdd != BDD_INVALID);
+        return bdd;
+    } else if((op = getOperatorOfNode(node)) > 0) {
+        if(!xmlHasProp(node, ATTR_NAME_VALVE_NO)) {
+            fprintf(stderr, "%s node has no valveNo\n", node->name);
+            return BDD_INVALID;
+        }
+        while(child != NULL && child->type != XML_ELEMENT_NODE) {
+            child = child->next;
+        }
+        if(child) {
+            bdd = parseNodeBdd(child, map, &depth1, NULL);
+            assert(bdd != BDD_INVALID);
+            if(op == OP_NOT) {
+                bdd = bddNot(map->bdd, bdd);
+            }
+            child = child->next;
+            while(child) {
+                if(child->type == XML_ELEMENT_NODE) {
+                    if(op == OP_NOT) {
+                        fprintf(stderr, "Not operator can only have one param\n");
+                        return BDD_INVALID;
+                    }
+                    bdd2 = parseNodeBdd(child, map, &depth2, NULL);
+                    assert(bdd2 != BDD_INVALID);
+                    depth1 = fmax(depth1, depth2);
+                    if(op == OP_AND) {
+                        bdd = bddAnd(map->bdd, bdd, bdd2);
+                    } else if(op == OP_OR) {
+                        bdd = bddOr(map->bdd, bdd, bdd2);
+                    }
+                }
+                child = child->next;
+            }
+            if(valveNoOut != NULL) {
+                contents = xmlGetProp(node, ATTR_NAME_VALVE_NO);
+                *valveNoOut = atoi(contents);
+                xmlFree(contents);
+            }
+            *depthOut = depth1 + 1;
+            return bdd;
+        } else {
+            fprintf(stderr, "Operator node has no params\n");
+            return BDD_INVALID;
+        }
+    } else if(strEqual(node->name, NODE_NAME_TP)) {
+        while(child) {
+            if(child->type == XML_ELEMENT_NODE) {
+                bdd = parseNodeBdd(child, map, depthOut, valveNoOut);
+                assert(bdd != BDD_INVALID);
+                return bdd;
+            }
+            child = child->next;
+        }
+        inputIndex = findInputIndexInMap(map, node);
+        if(inputIndex < 0) {
+            fprintf(stderr, "TP has no child nodes but isn't an indexed input\n");
+            return BDD_INVALID;
+        }
+        *depthOut = 0;
+        if(valveNoOut != NULL) {
+            *valveNoOut = -1;
+        }
+        return bddVar(map->bdd, inputIndex);
+    } else {
+        fprintf(stderr, "Unknown node type \"%s\"\n", node->name);
+        return BDD_INVALID;
+    }
+}
+
+int measureNode(xmlNode* node, NodeIdMap* map, int* depthOut, int* valveNoOut);
+
+int measureMappedNode(NodeIdMap* map, int index, int* depthOut, int* valveNoOut) {
+    NodeEvaluation* eval = &map->evaluations[index];
+    xmlChar* id;
+    if(eval->state == NODE_EVALUATING) {
+        id = xmlGetProp(map->nodes[index], ATTR_NAME_ID);
+        fprintf(stderr, "Node \"%s\" refers to itself\n", id);
+        xmlFree(id);
+        return -1;
+    }
+    if(eval->state == NODE_UNEVALUATED) {
+        eval->state = NODE_EVALUATING;
+        if(measureNode(map->nodes[index], map, &eval->depth, &eval->valveNo) < 0) {
+            eval->state = NODE_UNEVALUATED;
+            return -1;
+        }
+        eval->state = NODE_EVALUATED;
+    }
+    *depthOut = eval->depth;
+    if(valveNoOut != NULL) {
+        *valveNoOut = eval->valveNo;
+    }
+    return 0;
+}
+
+/*
+ * As parseNode, but only finds the depth and valve of a node, for sets whose
+ * TPs are evaluated by a CircuitProgram rather than as tables
+ */
+int measureNode(xmlNode* node, NodeIdMap* map, int* depthOut, int* valveNoOut) {
+    xmlNode* child;
+    xmlChar* contents;
+    int op, nodeIndex, depth, nOperands = 0;
+    if(strEqual(node->name, NODE_NAME_REF)) {
+        contents = xmlNodeListGetString(node->doc, node->children, 1);
+        nodeIndex = findNodeIndexInMap(map, contents);
+        xmlFree(contents);
+        if(nodeIndex < 0) {
+            return -1;
+        }
+        return measureMappedNode(map, nodeIndex, depthOut, valveNoOut);
+    } else if((op = getOperatorOfNode(node)) > 0) {
+        if(!xmlHasProp(node, ATTR_NAME_VALVE_NO)) {
+            fprintf(stderr, "%s node has no valveNo\n", node->name);
+            return -1;
+        }
+        *depthOut = 0;
+        for(child = node->children; child != NULL; child = child->next) {
+            if(child->type != XML_ELEMENT_NODE) {
+                continue;
+            }
+            if(op == OP_NOT && nOperands > 0) {
+                fprintf(stderr, "Not operator can only have one param\n");
+                return -1;
+            }
+            if(measureNode(child, map, &depth, NULL) < 0) {
+                return -1;
+            }
+            *depthOut = depth > *depthOut ? depth : *depthOut;
+            nOperands++;
+        }
+        if(nOperands == 0) {
+            fprintf(stderr, "Operator node has no params\n");
+            return -1;
+        }
+        if(valveNoOut != NULL) {
+            *valveNoOut = nodePropAsInteger(node, ATTR_NAME_VALVE_NO);
+        }
+        (*depthOut)++;
+        return 0;
+    } else if(strEqual(node->name, NODE_NAME_TP)) {
+        for(child = node->children; child != NULL; child = child->next) {
+            if(child->type == XML_ELEMENT_NODE) {
+                return measureNode(child, map, depthOut, valveNoOut);
+            }
+        }
+        if(findInputIndexInMap(map, node) < 0) {
+            fprintf(stderr, "TP has no child nodes but isn't an indexed input\n");
+            return -1;
+        }
+        *depthOut = 0;
+        if(valveNoOut != NULL) {
+            *valveNoOut = -1;
+        }
+        return 0;
+    }
+    fprintf(stderr, "Unknown node type \"%s\"\n", node->name);
+    return -1;
+}
+
+TestPoint* createTestPointFromXMLNode(xmlNode* tpNode, TruthWord* truthTable, BddRef bdd, int valveNo) {
     TestPoint* tp;
     xmlChar* tempStr;
     if(!xmlHasProp(tpNode, ATTR_NAME_ID)) {
@@ -218,6 +559,7 @@ TestPoint* createTestPointFromXMLNode(xmlNode* tpNode, int* truthTable, int valv
     tp = malloc(sizeof(TestPoint));
     tp->valveNo = valveNo;
     tp->truth = truthTable;
+    tp->bdd = bdd;
     tempStr = xmlGetProp(tpNode, ATTR_NAME_ID);
     tp->tpName = strcpy(malloc((xmlStrlen(tempStr)+1) * sizeof(char)), tempStr);
     free(tempStr);
@@ -229,133 +571,486 @@ TestPoint* createTestPointFromXMLNode(xmlNode* tpNode, int* truthTable, int valv
 void freeTestPoint(TestPoint* tp) {
     if(tp != NULL) {
         free(tp->tpName);
-        free(tp->truth);
         free(tp);
     }
 }
 
-AssertionsSet* createAssertionSetFromXMLNode(xmlNode* circuitNode) {
+int levelNode(xmlNode* node, NodeIdMap* map, int* nodeLevels);
+
+int levelMappedNode(NodeIdMap* map, int index, int* nodeLevels) {
+    xmlChar* id;
+    if(nodeLevels[index] == NODE_LEVELLING) {
+        id = xmlGetProp(map->nodes[index], ATTR_NAME_ID);
+        fprintf(stderr, "Node \"%s\" refers to itself\n", id);
+        xmlFree(id);
+        return -1;
+    }
+    if(nodeLevels[index] == NODE_UNLEVELLED) {
+        nodeLevels[index] = NODE_LEVELLING;
+        nodeLevels[index] = levelNode(map->nodes[index], map, nodeLevels);
+    }
+    return nodeLevels[index];
+}
+
+/*
+ * A node's level is one more than that of the deepest node with an id it
+ * refers to, so no node depends on another in the same level
+ */
+int levelNode(xmlNode* node, NodeIdMap* map, int* nodeLevels) {
+    xmlNode* child;
+    xmlChar* contents;
+    int index, childLevel, level = 0;
+    if(strEqual(node->name, NODE_NAME_REF)) {
+        contents = xmlNodeListGetString(node->doc, node->children, 1);
+        index = contents != NULL ? hashIndexGetStr(map->idIndices, contents) : -1;
+        xmlFree(contents);
+        if(index < 0) {
+            // Reported when the node is evaluated
+            return 0;
+        }
+        level = levelMappedNode(map, index, nodeLevels);
+        return level < 0 ? -1 : level + 1;
+    }
+    for(child = node->children; child != NULL; child = child->next) {
+        if(child->type == XML_ELEMENT_NODE) {
+            childLevel = levelNode(child, map, nodeLevels);
+            if(childLevel < 0) {
+                return -1;
+            }
+            level = childLevel > level ? childLevel : level;
+        }
+    }
+    return level;
+}
+
+typedef struct {
+    NodeIdMap* map;
+    xmlNode** tpNodes;
+    int nTp;
+    int* items;
+    int* levelStarts;
+    int nLevels;
+    int* nextItems;
+    TruthWord** tpTruths;
+    int* tpSharedTruths;
+    BddRef* tpBdds;
+    int* tpDepths;
+    int* tpValveNos;
+    int failed;
+    pthread_barrier_t barrier;
+} LevelEvaluation;
+
+/*
+ * Levelises every node with an id reachable from a TP, plus the TPs without
+ * one, and bucket sorts them by level. Items below map->n are node indices,
+ * the rest are TP indices offset by map->n
+ */
+LevelEvaluation* createLevelEvaluation(NodeIdMap* map, xmlNode** tpNodes, int* tpMapIndices, int nTp) {
+    LevelEvaluation* levels;
+    int* nodeLevels;
+    int* tpLevels;
+    int i, level, nItems = 0;
+    assert((nodeLevels = malloc((map->n + 1) * sizeof(int))) != NULL);
+    assert((tpLevels = malloc((nTp + 1) * sizeof(int))) != NULL);
+    for(i = 0; i < map->n; i++) {
+        nodeLevels[i] = NODE_UNLEVELLED;
+    }
+    for(i = 0; i < nTp; i++) {
+        if(tpMapIndices[i] >= 0) {
+            tpLevels[i] = levelMappedNode(map, tpMapIndices[i], nodeLevels);
+        } else {
+            tpLevels[i] = levelNode(tpNodes[i], map, nodeLevels);
+        }
+        if(tpLevels[i] < 0) {
+            free(nodeLevels);
+            free(tpLevels);
+            return NULL;
+        }
+    }
+    
+    levels = malloc(sizeof(LevelEvaluation));
+    levels->map = map;
+    levels->tpNodes = tpNodes;
+    levels->nTp = nTp;
+    levels->nLevels = 0;
+    for(i = 0; i < map->n + nTp; i++) {
+        level = i < map->n ? nodeLevels[i] : (tpMapIndices[i - map->n] < 0 ? tpLevels[i - map->n] : -1);
+        if(level >= 0) {
+            levels->nLevels = level + 1 > levels->nLevels ? level + 1 : levels->nLevels;
+            nItems++;
+        }
+    }
+    assert((levels->levelStarts = calloc(levels->nLevels + 1, sizeof(int))) != NULL);
+    assert((levels->nextItems = malloc((levels->nLevels + 1) * sizeof(int))) != NULL);
+    assert((levels->items = malloc((nItems + 1) * sizeof(int))) != NULL);
+    for(i = 0; i < map->n + nTp; i++) {
+        level = i < map->n ? nodeLevels[i] : (tpMapIndices[i - map->n] < 0 ? tpLevels[i - map->n] : -1);
+        if(level >= 0) {
+            levels->levelStarts[level + 1]++;
+        }
+    }
+    for(level = 0; level < levels->nLevels; level++) {
+        levels->levelStarts[level + 1] += levels->levelStarts[level];
+        levels->nextItems[level] = levels->levelStarts[level];
+    }
+    for(i = 0; i < map->n + nTp; i++) {
+        level = i < map->n ? nodeLevels[i] : (tpMapIndices[i - map->n] < 0 ? tpLevels[i - map->n] : -1);
+        if(level >= 0) {
+            levels->items[levels->nextItems[level]++] = i;
+        }
+    }
+    for(level = 0; level < levels->nLevels; level++) {
+        levels->nextItems[level] = levels->levelStarts[level];
+    }
+    
+    assert((levels->tpTruths = calloc(nTp + 1, sizeof(TruthWord*))) != NULL);
+    assert((levels->tpSharedTruths = calloc(nTp + 1, sizeof(int))) != NULL);
+    assert((levels->tpBdds = malloc((nTp + 1) * sizeof(BddRef))) != NULL);
+    assert((levels->tpDepths = calloc(nTp + 1, sizeof(int))) != NULL);
+    assert((levels->tpValveNos = malloc((nTp + 1) * sizeof(int))) != NULL);
+    for(i = 0; i < nTp; i++) {
+        levels->tpBdds[i] = BDD_INVALID;
+        levels->tpValveNos[i] = -1;
+    }
+    levels->failed = 0;
+    free(nodeLevels);
+    free(tpLevels);
+    return levels;
+}
+
+void freeLevelEvaluation(LevelEvaluation* levels) {
+    if(levels != NULL) {
+        free(levels->items);
+        free(levels->levelStarts);
+        free(levels->nextItems);
+        free(levels->tpTruths);
+        free(levels->tpSharedTruths);
+        free(levels->tpBdds);
+        free(levels->tpDepths);
+        free(levels->tpValveNos);
+        free(levels);
+    }
+}
+
+void evaluateLevelItem(LevelEvaluation* levels, int item) {
+    NodeIdMap* map = levels->map;
+    int tp = item - map->n;
+    if(item < map->n) {
+        if(evaluateMappedNode(map, item) < 0) {
+            __sync_lock_test_and_set(&levels->failed, 1);
+        }
+    } else if(map->bdd != NULL) {
+        levels->tpBdds[tp] = parseNodeBdd(levels->tpNodes[tp], map, &levels->tpDepths[tp], &levels->tpValveNos[tp]);
+        if(levels->tpBdds[tp] == BDD_INVALID) {
+            __sync_lock_test_and_set(&levels->failed, 1);
+        }
+    } else {
+        levels->tpTruths[tp] = parseNode(levels->tpNodes[tp], map, &levels->tpDepths[tp], &levels->tpValveNos[tp], 
+                &levels->tpSharedTruths[tp]);
+        if(levels->tpTruths[tp] == NULL) {
+            __sync_lock_test_and_set(&levels->failed, 1);
+        }
+    }
+}
+
+/*
+ * Every worker claims items from the current level until it is exhausted,
+ * then waits for the others before moving on, as the next level reads the
+ * cached evaluations of this one
+ */
+void* evaluateLevels(void* arg) {
+    LevelEvaluation* levels = arg;
+    int level, item;
+    for(level = 0; level < levels->nLevels; level++) {
+        while((item = __sync_fetch_and_add(&levels->nextItems[level], 1)) < levels->levelStarts[level + 1]) {
+            evaluateLevelItem(levels, levels->items[item]);
+        }
+        pthread_barrier_wait(&levels->barrier);
+    }
+    return NULL;
+}
+
+int runLevelEvaluation(LevelEvaluation* levels) {
+    pthread_t* threads;
+    long nThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int i, maxLevelItems = 0;
+    for(i = 0; i < levels->nLevels; i++) {
+        if(levels->levelStarts[i + 1] - levels->levelStarts[i] > maxLevelItems) {
+            maxLevelItems = levels->levelStarts[i + 1] - levels->levelStarts[i];
+        }
+    }
+    // The BDD manager is not thread safe, so wide circuits are built serially
+    if(levels->map->bdd != NULL || nThreads < 1) {
+        nThreads = 1;
+    }
+    if(nThreads > maxLevelItems) {
+        nThreads = maxLevelItems > 0 ? maxLevelItems : 1;
+    }
+    pthread_barrier_init(&levels->barrier, NULL, nThreads);
+    assert((threads = malloc(nThreads * sizeof(pthread_t))) != NULL);
+    for(i = 1; i < nThreads; i++) {
+        if(pthread_create(&threads[i], NULL, evaluateLevels, levels) != 0) {
+            fprintf(stderr, "Failed to start circuit evaluation thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    evaluateLevels(levels);
+    for(i = 1; i < nThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    pthread_barrier_destroy(&levels->barrier);
+    return levels->failed ? -1 : 0;
+}
+
+/*
+ * Finds the depth and valve of every TP without evaluating any node
+ */
+int measureLevelEvaluation(LevelEvaluation* levels, int* tpMapIndices) {
+    int i, result;
+    for(i = 0; i < levels->nTp; i++) {
+        if(tpMapIndices[i] >= 0) {
+            result = measureMappedNode(levels->map, tpMapIndices[i], &levels->tpDepths[i], &levels->tpValveNos[i]);
+        } else {
+            result = measureNode(levels->tpNodes[i], levels->map, &levels->tpDepths[i], &levels->tpValveNos[i]);
+        }
+        if(result < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Gives the set every table its TPs use, taking those shared from the cache
+ * out of it so they outlive the node map. Cached tables no TP uses are left
+ * to be freed with the map
+ */
+void collectTruthTables(AssertionsSet* set, NodeIdMap* map, LevelEvaluation* levels) {
+    HashIndex* owners = createHashIndex(map->n);
+    TruthWord* truth;
+    int i, owner;
+    set->truths = NULL;
+    set->nTruths = 0;
+    for(i = 0; i < map->n; i++) {
+        if(map->evaluations[i].truth != NULL && !map->evaluations[i].sharedTruth) {
+            hashIndexPut(owners, &map->evaluations[i].truth, sizeof(TruthWord*), i);
+        }
+    }
+    for(i = 0; i < levels->nTp; i++) {
+        truth = levels->tpTruths[i];
+        if(truth == NULL) {
+            continue;
+        }
+        if(levels->tpSharedTruths[i]) {
+            owner = hashIndexGet(owners, &truth, sizeof(TruthWord*));
+            assert(owner >= 0);
+            if(map->evaluations[owner].truth == NULL) {
+                // Already taken for another TP
+                continue;
+            }
+            map->evaluations[owner].truth = NULL;
+        }
+        set->truths = realloc(set->truths, (set->nTruths + 1) * sizeof(TruthWord*));
+        set->truths[set->nTruths++] = truth;
+    }
+    freeHashIndex(owners);
+}
+
+/*
+ * Loads the TPs of a circuit, sorted by depth. Unless evaluate is set their
+ * tables are not built, leaving them to be evaluated by a CircuitProgram
+ */
+AssertionsSet* buildAssertionSet(xmlNode* circuitNode, int evaluate) {
     AssertionsSet* set = malloc(sizeof(AssertionsSet));
     xmlNode* child = circuitNode->children;
-    int i;
-    int* tmpTruth = NULL;
-    int tmpDepth, tmpValveNo;
+    int i, j, maxDepth;
     xmlNode** tpNodes = NULL;
+    int* tpMapIndices = NULL;
+    int* depthStarts;
     NodeIdMap* nodeMap = createNodeIdMap();
-    LinkedListSortingNode* thisNode;
-    LinkedListSortingNode* llNode;
+    LevelEvaluation* levels;
+    int mapIndex;
     set->nTp = 0;
     
     while(child) {
+        mapIndex = -1;
+        if(xmlHasProp(child, ATTR_NAME_ID)) {
+            mapIndex = addNodeToIdMap(nodeMap, child);
+        }
         if(strEqual(child->name, NODE_NAME_TP)) {
             tpNodes = realloc(tpNodes, (set->nTp + 1) * sizeof(xmlNode*));
             tpNodes[set->nTp] = child;
+            tpMapIndices = realloc(tpMapIndices, (set->nTp + 1) * sizeof(int));
+            tpMapIndices[set->nTp] = mapIndex;
             set->nTp++;
             if(!nodeHasElementChildren(child)) {
                 addInputNodeToIdMap(nodeMap, child);
             }
         }
-        if(xmlHasProp(child, ATTR_NAME_ID)) {
-            addNodeToIdMap(nodeMap, child);
-        }
         child = child->next;
     }
-    LinkedListSortingNode* ll = NULL;
+    if(evaluate && nodeMap->nInputs > MAX_TRUTH_TABLE_INPUTS) {
+        nodeMap->bdd = createBddManager(nodeMap->nInputs);
+    }
+    
+    levels = createLevelEvaluation(nodeMap, tpNodes, tpMapIndices, set->nTp);
+    if(levels == NULL || (evaluate ? runLevelEvaluation(levels) : measureLevelEvaluation(levels, tpMapIndices)) < 0) {
+        freeLevelEvaluation(levels);
+        freeBddManager(nodeMap->bdd);
+        freeNodeIdMap(nodeMap);
+        free(tpNodes);
+        free(tpMapIndices);
+        free(set);
+        return NULL;
+    }
+    maxDepth = 0;
     for(i = 0; i < set->nTp; i++) {
-        tmpTruth = parseNode(tpNodes[i],nodeMap,&tmpDepth,&tmpValveNo);
-        assert(tmpTruth != NULL);
-        
-        llNode = malloc(sizeof(LinkedListSortingNode));
-        llNode->next = NULL;
-        llNode->prev = NULL;
-        llNode->tp = createTestPointFromXMLNode(tpNodes[i], tmpTruth, tmpValveNo);
-        llNode->depth = tmpDepth;
-        
-        if(ll == NULL) {
-            ll = llNode;
-        } else {
-            thisNode = ll;
-            while(thisNode != NULL) {
-                if(thisNode->depth >= llNode->depth) {
-                    if(thisNode->prev != NULL) {
-                        thisNode->prev->next = llNode;
-                    }
-                    llNode->prev = thisNode->prev;
-                    llNode->next = thisNode;
-                    thisNode->prev = llNode;
-                    if(thisNode == ll) {
-                        ll = llNode;
-                    }
-                    break;
-                } else if(thisNode->next == NULL) {
-                    llNode->prev = thisNode;
-                    thisNode->next = llNode;
-                    break;
-                }
-                thisNode = thisNode->next;
-            }
-            assert(thisNode != NULL);
+        if(evaluate && tpMapIndices[i] >= 0 && nodeMap->bdd != NULL) {
+            levels->tpBdds[i] = parseMappedNodeBdd(nodeMap, tpMapIndices[i], &levels->tpDepths[i], &levels->tpValveNos[i]);
+        } else if(evaluate && tpMapIndices[i] >= 0) {
+            levels->tpTruths[i] = parseMappedNode(nodeMap, tpMapIndices[i], &levels->tpDepths[i], &levels->tpValveNos[i]);
+            levels->tpSharedTruths[i] = 1;
         }
+        maxDepth = levels->tpDepths[i] > maxDepth ? levels->tpDepths[i] : maxDepth;
     }
     
-    thisNode = ll;
+    // Bucket sort the TPs by depth. Within a depth, later TPs come first
+    assert((depthStarts = calloc(maxDepth + 2, sizeof(int))) != NULL);
+    for(i = 0; i < set->nTp; i++) {
+        depthStarts[levels->tpDepths[i] + 1]++;
+    }
+    for(i = 0; i < maxDepth; i++) {
+        depthStarts[i + 1] += depthStarts[i];
+    }
     set->tps = malloc(set->nTp * sizeof(TestPoint*));
     set->nInputs = nodeMap->nInputs;
-    for(i = 0; i < set->nTp; i++) {
-        assert(thisNode != NULL);
-        set->tps[i] = thisNode->tp;
-        if(thisNode->next != NULL) {
-            thisNode = thisNode->next;
-            free(thisNode->prev);
-        } else {
-            free(thisNode);
+    for(i = set->nTp - 1; i >= 0; i--) {
+        set->tps[depthStarts[levels->tpDepths[i]]++] = createTestPointFromXMLNode(tpNodes[i], 
+                levels->tpTruths[i], levels->tpBdds[i], levels->tpValveNos[i]);
+    }
+    free(depthStarts);
+    collectTruthTables(set, nodeMap, levels);
+    freeLevelEvaluation(levels);
+    
+    // Input TPs are sorted by depth rather than input index, so record which
+    // bit of the table row each of them drives
+    set->bdd = nodeMap->bdd;
+    set->evaluated = evaluate;
+    set->inputRowBits = malloc((set->nInputs + 1) * sizeof(int));
+    for(i = 0; i < set->nInputs && evaluate; i++) {
+        if(set->bdd != NULL) {
+            set->inputRowBits[i] = bddTopVar(set->bdd, set->tps[i]->bdd);
+            continue;
         }
+        for(j = 0; j < set->nInputs; j++) {
+            if(getTruthTableValue(set->tps[i]->truth, 1 << j)) {
+                set->inputRowBits[i] = j;
+                break;
+            }
+        }
+        assert(j < set->nInputs);
+    }
+    
+    set->tpIndices = createHashIndex(set->nTp);
+    for(i = 0; i < set->nTp; i++) {
+        hashIndexPutStr(set->tpIndices, set->tps[i]->tpName, i);
     }
     
     freeNodeIdMap(nodeMap);
     free(tpNodes);
+    free(tpMapIndices);
     return set;
 }
 
+AssertionsSet* createAssertionSetFromXMLNode(xmlNode* circuitNode) {
+    return buildAssertionSet(circuitNode, 1);
+}
+
+AssertionsSet* createUnevaluatedAssertionSetFromXMLNode(xmlNode* circuitNode) {
+    return buildAssertionSet(circuitNode, 0);
+}
+
 void freeAssertionSet(AssertionsSet* set) {
     int i;
     if(set != NULL) {
         for(i = 0; i < set->nTp; i++) {
             freeTestPoint(set->tps[i]);
         }
+        free(set->tps);
+        for(i = 0; i < set->nTruths; i++) {
+            free(set->truths[i]);
+        }
+        free(set->truths);
+        free(set->inputRowBits);
+        freeHashIndex(set->tpIndices);
+        freeBddManager(set->bdd);
         free(set);
     }
 }
 
 int findTableRowForInputs(AssertionsSet* set, int* samples) {
-    int i, j, nCombs = 1 << set->nInputs;
-    for(j = 0; j < nCombs; j++) {
-        for(i = 0; i < set->nInputs; i++) {
-            if(set->tps[i]->truth[j] != samples[i]) {
-                i = -1;
-                break;
-            }
+    int i, row = 0;
+    assert(set->evaluated && set->bdd == NULL);
+    for(i = 0; i < set->nInputs; i++) {
+        if(samples[i]) {
+            row |= 1 << set->inputRowBits[i];
         }
-        if(i >= 0) {
-            return j;
+    }
+    return row;
+}
+
+void checkBdds(AssertionsSet* set, int* samples, int* values, int* dest, int* n) {
+    int i;
+    for(i = 0; i < set->nInputs; i++) {
+        values[set->inputRowBits[i]] = samples[i] != 0;
+    }
+    *n = 0;
+    for(i = set->nInputs; i < set->nTp; i++) {
+        if(bddEvaluate(set->bdd, set->tps[i]->bdd, values) != samples[i]) {
+            dest[*n] = i;
+            (*n)++;
         }
     }
-    return -1;
 }
 
 void checkTruthTable(AssertionsSet* set, int* samples, int* dest, int* n) {
-    int i;
-    int row = findTableRowForInputs(set, samples);
-    assert(row >= 0);
+    int i, row;
+    int* values;
+    assert(set->evaluated);
+    if(set->bdd != NULL) {
+        assert((values = malloc(set->nInputs * sizeof(int))) != NULL);
+        checkBdds(set, samples, values, dest, n);
+        free(values);
+        return;
+    }
+    row = findTableRowForInputs(set, samples);
     *n = 0;
     for(i = set->nInputs; i < set->nTp; i++) {
-        if(set->tps[i]->truth[row] != samples[i]) {
+        if(getTruthTableValue(set->tps[i]->truth, row) != samples[i]) {
             dest[*n] = i;
             (*n)++;
         }
     }
 }
 
+void checkTruthTableBatch(AssertionsSet* set, int* samples, int nVectors, int* dest, int* n) {
+    int i;
+    int* values;
+    assert(set->evaluated);
+    if(set->bdd != NULL) {
+        assert((values = malloc(set->nInputs * sizeof(int))) != NULL);
+        for(i = 0; i < nVectors; i++) {
+            checkBdds(set, samples + i * set->nTp, values, dest + i * set->nTp, n + i);
+        }
+        free(values);
+        return;
+    }
+    for(i = 0; i < nVectors; i++) {
+        checkTruthTable(set, samples + i * set->nTp, dest + i * set->nTp, n + i);
+    }
+}
+
 void printTPs(AssertionsSet* set) {
     int i, nColumns, nRows, maxCellStringLen;
     char** columns;
@@ -403,7 +1098,11 @@ void printTruthTable(AssertionsSet* set) {
     int i, j, nColumns, nRows, maxCellStringLen;
     char** columns;
     char*** rows;
-    assert(set != NULL);
+    assert(set != NULL && set->evaluated);
+    if(set->bdd != NULL) {
+        printf(BDD_TRUTH_TABLE_MESSAGE, set->nInputs);
+        return;
+    }
     
     maxCellStringLen = 8;
     nColumns = set->nTp;
@@ -417,7 +1116,7 @@ void printTruthTable(AssertionsSet* set) {
         rows[i] = malloc(sizeof(char*) * nColumns);
         for(j = 0; j < nColumns; j++) {
             rows[i][j] = malloc(sizeof(char) * maxCellStringLen);
-            snprintf(rows[i][j], maxCellStringLen, "%d", set->tps[j]->truth[i]);
+            snprintf(rows[i][j], maxCellStringLen, "%d", getTruthTableValue(set->tps[j]->truth, i));
         }
     }
     printTable(stdout, TRUTH_TABLE_TITLE, columns, nColumns, rows, nRows);
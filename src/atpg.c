@@ -0,0 +1,200 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "assertions.h"
+#include "atpg.h"
+#include "faultsim.h"
+#include "tables.h"
+
+#define TABLE_TITLE "Test Set"
+#define TABLE_VECTORS_HEADING "Vectors"
+#define TABLE_FAULTS_HEADING "Faults"
+#define TABLE_DETECTABLE_HEADING "Detectable"
+#define TABLE_COVERED_HEADING "Covered"
+
+int compareVectors(const void* a, const void* b) {
+    return *((const int*) a) - *((const int*) b);
+}
+
+/*
+ * Marks every fault detected by the index-th simulated vector as covered, and
+ * removes those faults from the number of uncovered faults each of their
+ * detecting vectors hits
+ */
+void coverFaultsWithVector(FaultSimulation* sim, int index, int* covered, int* gains) {
+    int i, v;
+    FaultResponse* response;
+    for(i = 0; i < sim->nResponses; i++) {
+        response = &sim->responses[i];
+        if(covered[i] || !isDetectingVectorIndex(response, index)) {
+            continue;
+        }
+        covered[i] = 1;
+        for(v = 0; v < sim->nVectors; v++) {
+            if(isDetectingVectorIndex(response, v)) {
+                gains[v]--;
+            }
+        }
+    }
+}
+
+/*
+ * Picks a small set of vectors that detects every fault the simulated vectors
+ * detect. Faults with a single detecting vector force that vector, the rest
+ * are covered greedily, and any vector made redundant by later picks is then
+ * dropped again. Vectors are worked with by their index in the simulation
+ * until the set is final
+ */
+TestSet* generateTestSet(FaultSimulation* sim) {
+    TestSet* testSet;
+    FaultResponse* response;
+    int* covered;
+    int* gains;
+    int* coverCounts;
+    int* chosen;
+    int i, j, v, best, redundant;
+    assert(sim != NULL);
+    
+    testSet = malloc(sizeof(TestSet));
+    testSet->vectors = NULL;
+    testSet->nVectors = 0;
+    testSet->nSampled = sim->vectors != NULL ? sim->nVectors : 0;
+    testSet->nFaults = sim->nResponses;
+    testSet->nDetectable = 0;
+    testSet->nCovered = 0;
+    assert((covered = calloc(sim->nResponses, sizeof(int))) != NULL);
+    assert((gains = calloc(sim->nVectors, sizeof(int))) != NULL);
+    assert((chosen = calloc(sim->nVectors, sizeof(int))) != NULL);
+    for(i = 0; i < sim->nResponses; i++) {
+        response = &sim->responses[i];
+        if(response->nDetectingVectors == 0) {
+            covered[i] = 1;
+            continue;
+        }
+        testSet->nDetectable++;
+        for(v = 0; v < sim->nVectors; v++) {
+            if(isDetectingVectorIndex(response, v)) {
+                gains[v]++;
+            }
+        }
+    }
+    
+    for(i = 0; i < sim->nResponses; i++) {
+        response = &sim->responses[i];
+        if(!covered[i] && response->nDetectingVectors == 1) {
+            for(v = 0; !isDetectingVectorIndex(response, v); v++);
+            chosen[v] = 1;
+            coverFaultsWithVector(sim, v, covered, gains);
+        }
+    }
+    while(1) {
+        best = -1;
+        for(v = 0; v < sim->nVectors; v++) {
+            if(gains[v] > 0 && (best < 0 || gains[v] > gains[best])) {
+                best = v;
+            }
+        }
+        if(best < 0) {
+            break;
+        }
+        chosen[best] = 1;
+        coverFaultsWithVector(sim, best, covered, gains);
+    }
+    
+    for(v = 0; v < sim->nVectors; v++) {
+        if(chosen[v]) {
+            testSet->vectors = realloc(testSet->vectors, (testSet->nVectors + 1) * sizeof(int));
+            testSet->vectors[testSet->nVectors++] = v;
+        }
+    }
+    assert((coverCounts = calloc(sim->nResponses, sizeof(int))) != NULL);
+    for(i = 0; i < sim->nResponses; i++) {
+        for(j = 0; j < testSet->nVectors; j++) {
+            coverCounts[i] += isDetectingVectorIndex(&sim->responses[i], testSet->vectors[j]);
+        }
+    }
+    for(j = testSet->nVectors - 1; j >= 0; j--) {
+        v = testSet->vectors[j];
+        redundant = 1;
+        for(i = 0; i < sim->nResponses && redundant; i++) {
+            if(coverCounts[i] == 1 && isDetectingVectorIndex(&sim->responses[i], v)) {
+                redundant = 0;
+            }
+        }
+        if(redundant) {
+            for(i = 0; i < sim->nResponses; i++) {
+                if(isDetectingVectorIndex(&sim->responses[i], v)) {
+                    coverCounts[i]--;
+                }
+            }
+            testSet->vectors[j] = testSet->vectors[--testSet->nVectors];
+        }
+    }
+    for(j = 0; j < testSet->nVectors; j++) {
+        testSet->vectors[j] = getSimulatedVector(sim, testSet->vectors[j]);
+    }
+    qsort(testSet->vectors, testSet->nVectors, sizeof(int), compareVectors);
+    for(i = 0; i < sim->nResponses; i++) {
+        if(coverCounts[i] > 0) {
+            testSet->nCovered++;
+        }
+    }
+    
+    free(covered);
+    free(gains);
+    free(chosen);
+    free(coverCounts);
+    return testSet;
+}
+
+void freeTestSet(TestSet* testSet) {
+    if(testSet != NULL) {
+        free(testSet->vectors);
+        free(testSet);
+    }
+}
+
+int countTestSetDetections(FaultSimulation* sim, TestSet* testSet, FaultResponse* response) {
+    int i, n = 0;
+    for(i = 0; i < testSet->nVectors; i++) {
+        if(isDetectingVector(sim, response, testSet->vectors[i])) {
+            n++;
+        }
+    }
+    return n;
+}
+
+void printTestSet(TestSet* testSet) {
+    int i, nColumns, maxCellStringLen;
+    char** columns;
+    char*** rows;
+    assert(testSet != NULL);
+    
+    maxCellStringLen = 16;
+    nColumns = 4;
+    assert((columns = malloc(sizeof(char*) * nColumns)) != NULL);
+    columns[0] = TABLE_VECTORS_HEADING;
+    columns[1] = TABLE_FAULTS_HEADING;
+    columns[2] = TABLE_DETECTABLE_HEADING;
+    columns[3] = TABLE_COVERED_HEADING;
+    assert((rows = malloc(sizeof(char**))) != NULL);
+    assert((rows[0] = malloc(sizeof(char*) * nColumns)) != NULL);
+    for(i = 0; i < nColumns; i++) {
+        assert((rows[0][i] = malloc(sizeof(char) * maxCellStringLen)) != NULL);
+    }
+    snprintf(rows[0][0], maxCellStringLen, "%d", testSet->nVectors);
+    snprintf(rows[0][1], maxCellStringLen, "%d", testSet->nFaults);
+    snprintf(rows[0][2], maxCellStringLen, "%d", testSet->nDetectable);
+    snprintf(rows[0][3], maxCellStringLen, "%d", testSet->nCovered);
+    printTable(stdout, TABLE_TITLE, columns, nColumns, rows, 1);
+    if(testSet->nSampled > 0) {
+        printf("Test set picked from a sample of %d vectors, so faults only detected by other "
+                "vectors are not counted and coverage is not guaranteed\n", testSet->nSampled);
+    }
+    for(i = 0; i < nColumns; i++) {
+        free(rows[0][i]);
+    }
+    free(rows[0]);
+    free(rows);
+    free(columns);
+}
@@ -0,0 +1,154 @@
+#include <assert.h>
+#include <stdlib.h>
+#include "bdd.h"
+#include "hashindex.h"
+
+#define BDD_OP_AND 1
+#define BDD_OP_OR 2
+#define BDD_OP_NOT 3
+#define MIN_CAPACITY 64
+
+BddManager* createBddManager(int nVars) {
+    BddManager* bdd = malloc(sizeof(BddManager));
+    bdd->capacity = MIN_CAPACITY;
+    assert((bdd->nodes = malloc(bdd->capacity * sizeof(BddNode))) != NULL);
+    bdd->nVars = nVars;
+    // Terminals sit below every variable in the ordering
+    bdd->nodes[BDD_FALSE].var = nVars;
+    bdd->nodes[BDD_FALSE].low = BDD_FALSE;
+    bdd->nodes[BDD_FALSE].high = BDD_FALSE;
+    bdd->nodes[BDD_TRUE].var = nVars;
+    bdd->nodes[BDD_TRUE].low = BDD_TRUE;
+    bdd->nodes[BDD_TRUE].high = BDD_TRUE;
+    bdd->nNodes = 2;
+    bdd->unique = createHashIndex(0);
+    bdd->computed = createHashIndex(0);
+    return bdd;
+}
+
+void freeBddManager(BddManager* bdd) {
+    if(bdd != NULL) {
+        free(bdd->nodes);
+        freeHashIndex(bdd->unique);
+        freeHashIndex(bdd->computed);
+        free(bdd);
+    }
+}
+
+BddRef makeBddNode(BddManager* bdd, int var, BddRef low, BddRef high) {
+    int key[3];
+    BddRef ref;
+    if(low == high) {
+        return low;
+    }
+    key[0] = var;
+    key[1] = low;
+    key[2] = high;
+    ref = hashIndexGet(bdd->unique, key, sizeof(key));
+    if(ref >= 0) {
+        return ref;
+    }
+    if(bdd->nNodes >= bdd->capacity) {
+        bdd->capacity *= 2;
+        assert((bdd->nodes = realloc(bdd->nodes, bdd->capacity * sizeof(BddNode))) != NULL);
+    }
+    ref = bdd->nNodes++;
+    bdd->nodes[ref].var = var;
+    bdd->nodes[ref].low = low;
+    bdd->nodes[ref].high = high;
+    hashIndexPut(bdd->unique, key, sizeof(key), ref);
+    return ref;
+}
+
+BddRef bddVar(BddManager* bdd, int var) {
+    assert(var >= 0 && var < bdd->nVars);
+    return makeBddNode(bdd, var, BDD_FALSE, BDD_TRUE);
+}
+
+int bddTopVar(BddManager* bdd, BddRef a) {
+    return bdd->nodes[a].var;
+}
+
+BddRef bddApply(BddManager* bdd, int op, BddRef a, BddRef b) {
+    int key[3], var;
+    BddRef tmp, aLow, aHigh, bLow, bHigh, low, high, result;
+    if(op == BDD_OP_NOT) {
+        if(a == BDD_FALSE || a == BDD_TRUE) {
+            return a == BDD_FALSE ? BDD_TRUE : BDD_FALSE;
+        }
+    } else {
+        if(a > b) {
+            tmp = a;
+            a = b;
+            b = tmp;
+        }
+        if(a == b) {
+            return a;
+        }
+        if(op == BDD_OP_AND) {
+            if(a == BDD_FALSE) {
+                return BDD_FALSE;
+            } else if(a == BDD_TRUE) {
+                return b;
+            }
+        } else if(op == BDD_OP_OR) {
+            if(a == BDD_TRUE) {
+                return BDD_TRUE;
+            } else if(a == BDD_FALSE) {
+                return b;
+            }
+        }
+    }
+    key[0] = op;
+    key[1] = a;
+    key[2] = b;
+    result = hashIndexGet(bdd->computed, key, sizeof(key));
+    if(result >= 0) {
+        return result;
+    }
+    
+    // Node storage may move during the recursion, so copy out the cofactors
+    var = bdd->nodes[a].var;
+    if(op != BDD_OP_NOT && bdd->nodes[b].var < var) {
+        var = bdd->nodes[b].var;
+    }
+    aLow = aHigh = a;
+    if(bdd->nodes[a].var == var) {
+        aLow = bdd->nodes[a].low;
+        aHigh = bdd->nodes[a].high;
+    }
+    if(op == BDD_OP_NOT) {
+        low = bddApply(bdd, op, aLow, aLow);
+        high = bddApply(bdd, op, aHigh, aHigh);
+    } else {
+        bLow = bHigh = b;
+        if(bdd->nodes[b].var == var) {
+            bLow = bdd->nodes[b].low;
+            bHigh = bdd->nodes[b].high;
+        }
+        low = bddApply(bdd, op, aLow, bLow);
+        high = bddApply(bdd, op, aHigh, bHigh);
+    }
+    result = makeBddNode(bdd, var, low, high);
+    hashIndexPut(bdd->computed, key, sizeof(key), result);
+    return result;
+}
+
+BddRef bddNot(BddManager* bdd, BddRef a) {
+    return bddApply(bdd, BDD_OP_NOT, a, a);
+}
+
+BddRef bddAnd(BddManager* bdd, BddRef a, BddRef b) {
+    return bddApply(bdd, BDD_OP_AND, a, b);
+}
+
+BddRef bddOr(BddManager* bdd, BddRef a, BddRef b) {
+    return bddApply(bdd, BDD_OP_OR, a, b);
+}
+
+int bddEvaluate(BddManager* bdd, BddRef a, const int* values) {
+    while(a != BDD_FALSE && a != BDD_TRUE) {
+        a = values[bdd->nodes[a].var] ? bdd->nodes[a].high : bdd->nodes[a].low;
+    }
+    return a == BDD_TRUE;
+}
@@ -0,0 +1,149 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "campaign.h"
+#include "tables.h"
+
+#define RIG_COMMENT '#'
+
+#define TABLE_TITLE "Campaign Results"
+#define TABLE_RIG_HEADING "Rig"
+#define TABLE_DEVICE_HEADING "Serial Device"
+#define TABLE_RX_PORT_HEADING "RX Port"
+#define TABLE_WIRING_HEADING "Wiring"
+#define TABLE_FAILED_HEADING "Failed"
+#define TABLE_TIME_HEADING "Time"
+#define TABLE_LOG_HEADING "Log"
+
+Rig* createRig(const char* deviceName, int rxPort, const char* wiringFile, const char* logFile) {
+    Rig* rig = malloc(sizeof(Rig));
+    assert((rig->deviceName = strdup(deviceName)) != NULL);
+    rig->rxPort = rxPort;
+    assert((rig->wiringFile = strdup(wiringFile)) != NULL);
+    rig->logFile = NULL;
+    if(logFile != NULL) {
+        assert((rig->logFile = strdup(logFile)) != NULL);
+    }
+    rig->pid = -1;
+    rig->resultFd = -1;
+    rig->result.nFailed = -1;
+    rig->result.nInjections = 0;
+    rig->result.elapsedS = 0;
+    return rig;
+}
+
+void freeRig(Rig* rig) {
+    if(rig != NULL) {
+        free(rig->deviceName);
+        free(rig->wiringFile);
+        free(rig->logFile);
+        free(rig);
+    }
+}
+
+/*
+ * Reads one rig per line as "<serial device> <rx port> <wiring file>",
+ * optionally followed by the file its output is logged to. Blank lines and
+ * lines starting with RIG_COMMENT are skipped
+ */
+RigCampaign* readRigCampaign(const char* filename) {
+    RigCampaign* campaign;
+    FILE* file;
+    char line[MAX_RIG_LINE_LEN];
+    char deviceName[MAX_RIG_FIELD_LEN + 1];
+    char wiringFile[MAX_RIG_FIELD_LEN + 1];
+    char logFile[MAX_RIG_FIELD_LEN + 1];
+    int rxPort, nFields, lineNo = 0;
+    file = fopen(filename, "r");
+    if(file == NULL) {
+        fprintf(stderr, "Could not open campaign file \"%s\"\n", filename);
+        return NULL;
+    }
+    campaign = malloc(sizeof(RigCampaign));
+    campaign->rigs = NULL;
+    campaign->nRigs = 0;
+    while(fgets(line, MAX_RIG_LINE_LEN, file) != NULL) {
+        lineNo++;
+        nFields = sscanf(line, "%64s %d %64s %64s", deviceName, &rxPort, wiringFile, logFile);
+        if(nFields <= 0 || deviceName[0] == RIG_COMMENT) {
+            continue;
+        }
+        if(nFields < 3) {
+            fprintf(stderr, "Line %d of %s does not describe a rig\n", lineNo, filename);
+            freeRigCampaign(campaign);
+            fclose(file);
+            return NULL;
+        }
+        if(nFields < 4) {
+            snprintf(logFile, MAX_RIG_FIELD_LEN + 1, RIG_LOG_FILENAME_FORMAT, campaign->nRigs);
+        }
+        campaign->rigs = realloc(campaign->rigs, sizeof(Rig*) * (campaign->nRigs + 1));
+        campaign->rigs[campaign->nRigs++] = createRig(deviceName, rxPort, wiringFile, logFile);
+    }
+    fclose(file);
+    if(campaign->nRigs == 0) {
+        fprintf(stderr, "No rigs are listed in %s\n", filename);
+        freeRigCampaign(campaign);
+        return NULL;
+    }
+    return campaign;
+}
+
+void freeRigCampaign(RigCampaign* campaign) {
+    int i;
+    if(campaign != NULL) {
+        for(i = 0; i < campaign->nRigs; i++) {
+            freeRig(campaign->rigs[i]);
+        }
+        free(campaign->rigs);
+        free(campaign);
+    }
+}
+
+void printRigResults(RigCampaign* campaign) {
+    Rig* rig;
+    int i, j, maxCellStringLen, nColumns;
+    char** columns;
+    char*** rows;
+    assert(campaign != NULL);
+    
+    maxCellStringLen = MAX_RIG_FIELD_LEN + 1;
+    nColumns = 7;
+    assert((columns = malloc(sizeof(char*) * nColumns)) != NULL);
+    columns[0] = TABLE_RIG_HEADING;
+    columns[1] = TABLE_DEVICE_HEADING;
+    columns[2] = TABLE_RX_PORT_HEADING;
+    columns[3] = TABLE_WIRING_HEADING;
+    columns[4] = TABLE_FAILED_HEADING;
+    columns[5] = TABLE_TIME_HEADING;
+    columns[6] = TABLE_LOG_HEADING;
+    assert((rows = malloc(sizeof(char**) * campaign->nRigs)) != NULL);
+    for(i = 0; i < campaign->nRigs; i++) {
+        rig = campaign->rigs[i];
+        rows[i] = malloc(sizeof(char*) * nColumns);
+        for(j = 0; j < nColumns; j++) {
+            rows[i][j] = malloc(sizeof(char) * maxCellStringLen);
+        }
+        snprintf(rows[i][0], maxCellStringLen, "%d", i);
+        snprintf(rows[i][1], maxCellStringLen, "%s", rig->deviceName);
+        snprintf(rows[i][2], maxCellStringLen, "%d", rig->rxPort);
+        snprintf(rows[i][3], maxCellStringLen, "%s", rig->wiringFile);
+        if(rig->result.nFailed < 0) {
+            snprintf(rows[i][4], maxCellStringLen, "aborted");
+        } else {
+            snprintf(rows[i][4], maxCellStringLen, "%d/%d", rig->result.nFailed, rig->result.nInjections);
+        }
+        snprintf(rows[i][5], maxCellStringLen, "%.3fs", rig->result.elapsedS);
+        snprintf(rows[i][6], maxCellStringLen, "%s", rig->logFile != NULL ? rig->logFile : "");
+    }
+    printTable(stdout, TABLE_TITLE, columns, nColumns, rows, campaign->nRigs);
+    for(i = 0; i < campaign->nRigs; i++) {
+        for(j = 0; j < nColumns; j++) {
+            free(rows[i][j]);
+        }
+        free(rows[i]);
+    }
+    free(rows);
+    free(columns);
+}
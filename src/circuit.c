@@ -1,14 +1,14 @@
 #include <assert.h>
 #include <math.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <libxml/tree.h>
 #include <libxml/xmlstring.h>
-#include <wiringPi.h>
-#include <wiringPiSPI.h>
 #include "circuit.h"
+#include "gpio.h"
 #include "xmlutil.h"
 #include "tables.h"
     
@@ -28,12 +28,32 @@
 #define TABLE_LOW_PIN_HEADING "Low Pin"
 #define TABLE_HIGH_PIN_HEADING "High Pin"
 
-void setupWiring() {
-    wiringPiSetupGpio();
+/*
+ * Claims the low and high pin of every valve as outputs through the backend,
+ * valve j's at indices 2j and 2j + 1, with no fault applied
+ */
+int setupWiring(Wiring* wiring, GpioBackend* gpio) {
+    int* pins;
+    int j, result;
+    assert((pins = malloc((2 * wiring->nValves + 1) * sizeof(int))) != NULL);
+    for(j = 0; j < wiring->nValves; j++) {
+        pins[2 * j] = wiring->valves[j]->lowGPIOPin;
+        pins[2 * j + 1] = wiring->valves[j]->highGPIOPin;
+    }
+    result = requestGpioOutputs(gpio, pins, 2 * wiring->nValves);
+    free(pins);
+    if(result < 0) {
+        return -1;
+    }
+    wiring->gpio = gpio;
+    return 0;
 }
 
-void teardownWiring() {
-    
+void teardownWiring(Wiring* wiring) {
+    if(wiring->gpio != NULL) {
+        setValveFault(wiring, -1, NONE);
+        wiring->gpio = NULL;
+    }
 }
 
 Wire* createWire(int tpIndex, int pin) {
@@ -60,13 +80,14 @@ void freeValve(Valve* valve) {
 }
 
 int getIndexOfTPIndexInWiring(Wiring* wiring, int tpIndex) {
-    int i;
-    for(i = 0; i < wiring->nWires; i++) {
-        if(wiring->wires[i]->tpIndex == tpIndex) {
-            return i;
-        }
+    if(tpIndex < 0 || tpIndex >= wiring->nTps) {
+        return -1;
     }
-    return -1;
+    return wiring->wireIndices[tpIndex];
+}
+
+int getIndexOfValveInWiring(Wiring* wiring, int valveNo) {
+    return hashIndexGetInt(wiring->valveIndices, valveNo);
 }
 
 Wiring* createWiringFromXMLNode(AssertionsSet* set, xmlNode* wiringNode) {
@@ -79,9 +100,16 @@ Wiring* createWiringFromXMLNode(AssertionsSet* set, xmlNode* wiringNode) {
     child = wiringNode->children;
     wiring->wires = NULL;
     wiring->nWires = 0;
+    wiring->nTps = set->nTp;
+    assert((wiring->wireIndices = malloc(set->nTp * sizeof(int))) != NULL);
+    for(j = 0; j < set->nTp; j++) {
+        wiring->wireIndices[j] = -1;
+    }
     wiring->maxPins = 0;
     wiring->valves = NULL;
     wiring->nValves = 0;
+    wiring->valveIndices = createHashIndex(0);
+    wiring->gpio = NULL;
     while(child != NULL) {
         if(child->type == XML_ELEMENT_NODE) {
             if(strEqual(child->name, NODE_NAME_TP)) {
@@ -101,12 +129,10 @@ Wiring* createWiringFromXMLNode(AssertionsSet* set, xmlNode* wiringNode) {
                     fprintf(stderr, "TP node refers to a tp not in the assertions set\n");
                     return NULL;
                 }
-                for(j = 0; j < wiring->nWires; j++) {
-                    if(wiring->wires[j]->tpIndex == tpIndex) {
-                        freeWiring(wiring);
-                        fprintf(stderr, "TP node is referenced twice in wiring file\n");
-                        return NULL;
-                    }
+                if(wiring->wireIndices[tpIndex] >= 0) {
+                    freeWiring(wiring);
+                    fprintf(stderr, "TP node is referenced twice in wiring file\n");
+                    return NULL;
                 }
                 pin = nodePropAsInteger(child, ATTR_NAME_PIN);
                 if(pin < 0) {
@@ -117,6 +143,7 @@ Wiring* createWiringFromXMLNode(AssertionsSet* set, xmlNode* wiringNode) {
                 
                 wiring->wires = realloc(wiring->wires, sizeof(Wire*) * (wiring->nWires + 1));
                 wiring->wires[wiring->nWires] = createWire(tpIndex, pin);
+                wiring->wireIndices[tpIndex] = wiring->nWires;
                 wiring->nWires++;
                 if(pin + 1 > wiring->maxPins) {
                     wiring->maxPins = pin + 1;
@@ -138,12 +165,10 @@ Wiring* createWiringFromXMLNode(AssertionsSet* set, xmlNode* wiringNode) {
                     return NULL;
                 }
                 number = nodePropAsInteger(child, ATTR_NAME_NUMBER);
-                for(j = 0; j < wiring->nValves; j++) {
-                    if(wiring->valves[j]->number == number) {
-                        freeWiring(wiring);
-                        fprintf(stderr, "valve number is referenced twice in wiring file\n");
-                        return NULL;
-                    }
+                if(getIndexOfValveInWiring(wiring, number) >= 0) {
+                    freeWiring(wiring);
+                    fprintf(stderr, "valve number is referenced twice in wiring file\n");
+                    return NULL;
                 }
                 highPin = nodePropAsInteger(child, ATTR_NAME_HIGH_PIN);
                 if(highPin < 0) {
@@ -151,7 +176,7 @@ Wiring* createWiringFromXMLNode(AssertionsSet* set, xmlNode* wiringNode) {
                     fprintf(stderr, "valve node has an invalid high pin attribute\n");
                     return NULL;
                 }
-                highPin = physPinToGpio(highPin);
+                highPin = getGpioOfHeaderPin(highPin);
                 if(highPin < 0) {
                     freeWiring(wiring);
                     fprintf(stderr, "valve node has an invalid high pin attribute as a GPIO\n");
@@ -163,7 +188,7 @@ Wiring* createWiringFromXMLNode(AssertionsSet* set, xmlNode* wiringNode) {
                     fprintf(stderr, "valve node has an invalid low pin attribute\n");
                     return NULL;
                 }
-                lowPin = physPinToGpio(lowPin);
+                lowPin = getGpioOfHeaderPin(lowPin);
                 if(lowPin < 0) {
                     freeWiring(wiring);
                     fprintf(stderr, "valve node has an invalid low pin attribute as a GPIO\n");
@@ -172,6 +197,7 @@ Wiring* createWiringFromXMLNode(AssertionsSet* set, xmlNode* wiringNode) {
                 
                 wiring->valves = realloc(wiring->valves, sizeof(Valve*) * (wiring->nValves + 1));
                 wiring->valves[wiring->nValves] = createValve(number, lowPin, highPin);
+                hashIndexPutInt(wiring->valveIndices, number, wiring->nValves);
                 wiring->nValves++;
             } else {
                 freeWiring(wiring);
@@ -188,11 +214,6 @@ Wiring* createWiringFromXMLNode(AssertionsSet* set, xmlNode* wiringNode) {
         return NULL;
     }
     
-    for(j = 0; j < wiring->nValves; j++) {
-        pinMode(wiring->valves[j]->lowGPIOPin, OUTPUT);
-        pinMode(wiring->valves[j]->highGPIOPin, OUTPUT);
-    }
-    
     return wiring;
 }
 
@@ -205,25 +226,36 @@ void freeWiring(Wiring* wiring) {
         for(i = 0; i < wiring->nValves; i++) {
             freeValve(wiring->valves[i]);
         }
+        free(wiring->wires);
+        free(wiring->wireIndices);
+        free(wiring->valves);
+        freeHashIndex(wiring->valveIndices);
         free(wiring);
     }
 }
 
-void setValveFault(Wiring* wiring, int valveNo, CircuitFault fault) {
+/*
+ * Sets the pins of every valve at once, so that only valveNo is forced
+ */
+int setValveFault(Wiring* wiring, int valveNo, CircuitFault fault) {
     int i, lowVal, highVal;
+    if(wiring->gpio == NULL) {
+        return 0;
+    }
     for(i = 0; i < wiring->nValves; i++) {
-        lowVal = LOW;
-        highVal = LOW;
+        lowVal = false;
+        highVal = false;
         if(wiring->valves[i]->number == valveNo) {
             if(fault == SA0) {
-                lowVal = HIGH;
+                lowVal = true;
             } else if(fault == SA1) {
-                highVal = HIGH;
+                highVal = true;
             }
         }
-        digitalWrite(wiring->valves[i]->lowGPIOPin, lowVal);
-        digitalWrite(wiring->valves[i]->highGPIOPin, highVal);
+        setGpioOutput(wiring->gpio, 2 * i, lowVal);
+        setGpioOutput(wiring->gpio, 2 * i + 1, highVal);
     }
+    return writeGpioOutputs(wiring->gpio);
 }
 
 /*void readInTPValues(Wiring* wiring, int* dest) {
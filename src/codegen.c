@@ -0,0 +1,52 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "assertions.h"
+#include "codegen.h"
+#include "program.h"
+
+/*
+ * Emits the circuit as straight-line C over one local per register. Only
+ * TP registers are stored back, so the compiler is free to keep the rest in
+ * machine registers and vectorise the loop over words
+ */
+void writeCircuitSource(FILE* stream, AssertionsSet* set, CircuitProgram* program) {
+    int i;
+    Instruction* instr;
+    assert(set != NULL);
+    assert(program != NULL);
+    
+    fprintf(stream, "/* Generated by circuitgen, do not edit */\n");
+    fprintf(stream, "#include <stdint.h>\n\n");
+    fprintf(stream, "const unsigned int %s = %uu;\n\n", COMPILED_CIRCUIT_HASH, 
+            getCircuitProgramHash(program));
+    fprintf(stream, "void %s(uint64_t* restrict r, int nWords) {\n", COMPILED_CIRCUIT_FUNCTION);
+    fprintf(stream, "    int w;\n");
+    fprintf(stream, "    for(w = 0; w < nWords; w++) {\n");
+    for(i = 0; i < program->nInputs; i++) {
+        fprintf(stream, "        const uint64_t r%d = r[%d * nWords + w]; /* %s */\n", 
+                i, i, set->tps[i]->tpName);
+    }
+    for(i = 0; i < program->nInstructions; i++) {
+        instr = &program->instructions[i];
+        switch(instr->op) {
+            case INSTR_AND: {
+                fprintf(stream, "        const uint64_t r%d = r%d & r%d;\n", instr->dst, instr->a, instr->b);
+                break;
+            }
+            case INSTR_OR: {
+                fprintf(stream, "        const uint64_t r%d = r%d | r%d;\n", instr->dst, instr->a, instr->b);
+                break;
+            }
+            case INSTR_NOT: {
+                fprintf(stream, "        const uint64_t r%d = ~r%d;\n", instr->dst, instr->a);
+                break;
+            }
+        }
+    }
+    for(i = program->nInputs; i < program->nTps; i++) {
+        fprintf(stream, "        r[%d * nWords + w] = r%d; /* %s */\n", 
+                program->tpRegisters[i], program->tpRegisters[i], set->tps[i]->tpName);
+    }
+    fprintf(stream, "    }\n}\n");
+}
@@ -0,0 +1,249 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assertions.h"
+#include "diagnosis.h"
+#include "faultsim.h"
+#include "hashindex.h"
+#include "program.h"
+#include "tables.h"
+
+#define TABLE_TITLE "Fault Dictionary"
+#define TABLE_VECTORS_HEADING "Vectors"
+#define TABLE_FAULTS_HEADING "Faults"
+#define TABLE_CLASSES_HEADING "Classes"
+#define TABLE_PASS_FAIL_CLASSES_HEADING "Pass/Fail Classes"
+
+int getWordsForBits(int nBits) {
+    return (nBits + TRUTH_WORD_BITS - 1) / TRUTH_WORD_BITS;
+}
+
+void addSyndromeFailure(FaultDictionary* dict, TruthWord* syndrome, int vectorPos, int tpIndex) {
+    assert(vectorPos >= 0 && vectorPos < dict->nVectors);
+    syndrome[vectorPos * dict->tpWords + tpIndex / TRUTH_WORD_BITS] |= 
+        ((TruthWord) 1) << (tpIndex % TRUTH_WORD_BITS);
+}
+
+void addFaultToClass(FaultClass** classes, int* nClasses, HashIndex* indices, 
+        int* faultClasses, int fault, TruthWord* key, int keyWords) {
+    FaultClass* faultClass;
+    int index = hashIndexGet(indices, key, keyWords * sizeof(TruthWord));
+    if(index < 0) {
+        index = (*nClasses)++;
+        *classes = realloc(*classes, *nClasses * sizeof(FaultClass));
+        (*classes)[index].faults = NULL;
+        (*classes)[index].nFaults = 0;
+        hashIndexPut(indices, key, keyWords * sizeof(TruthWord), index);
+    }
+    faultClass = &(*classes)[index];
+    faultClass->faults = realloc(faultClass->faults, (faultClass->nFaults + 1) * sizeof(int));
+    faultClass->faults[faultClass->nFaults++] = fault;
+    faultClasses[fault] = index;
+}
+
+/*
+ * Simulates every fault over the given vectors and groups faults by the TPs
+ * they make fail on each vector. Faults with identical syndromes cannot be
+ * told apart by these vectors and are collapsed into a single class. A
+ * coarser dictionary keyed only on which vectors failed is kept alongside it,
+ * for when the failing TPs are not known
+ */
+FaultDictionary* createFaultDictionary(CircuitProgram* program, FaultSimulation* sim, 
+        const int* vectors, int nVectors) {
+    FaultDictionary* dict;
+    TruthWord* good;
+    TruthWord* faulty;
+    TruthWord* syndromes;
+    TruthWord* syndrome;
+    TruthWord* passFail;
+    TruthWord diff;
+    int i, j, first, nLanes, lane, passFailWords, inputWords;
+    assert(program != NULL);
+    assert(sim != NULL);
+    if(nVectors > MAX_DICTIONARY_VECTORS) {
+        fprintf(stderr, "Too many vectors for a fault dictionary\n");
+        return NULL;
+    }
+    
+    dict = malloc(sizeof(FaultDictionary));
+    dict->sim = sim;
+    assert((dict->vectors = malloc((nVectors + 1) * sizeof(int))) != NULL);
+    memcpy(dict->vectors, vectors, nVectors * sizeof(int));
+    dict->nVectors = nVectors;
+    dict->vectorIndices = createHashIndex(nVectors);
+    for(i = 0; i < nVectors; i++) {
+        hashIndexPutInt(dict->vectorIndices, vectors[i], i);
+    }
+    dict->tpWords = getWordsForBits(program->nTps);
+    dict->syndromeWords = nVectors * dict->tpWords + 1;
+    dict->classes = NULL;
+    dict->nClasses = 0;
+    dict->classIndices = createHashIndex(sim->nResponses);
+    assert((dict->faultClasses = malloc(sim->nResponses * sizeof(int))) != NULL);
+    dict->passFailClasses = NULL;
+    dict->nPassFailClasses = 0;
+    dict->passFailIndices = createHashIndex(sim->nResponses);
+    assert((dict->faultPassFailClasses = malloc(sim->nResponses * sizeof(int))) != NULL);
+    
+    assert((syndromes = calloc(sim->nResponses * dict->syndromeWords, sizeof(TruthWord))) != NULL);
+    good = createProgramRegisters(program);
+    faulty = createProgramRegisters(program);
+    inputWords = program->nInputs * PROGRAM_BLOCK_WORDS;
+    for(first = 0; first < nVectors; first += PROGRAM_BLOCK_VECTORS) {
+        nLanes = nVectors - first < PROGRAM_BLOCK_VECTORS ? nVectors - first : PROGRAM_BLOCK_VECTORS;
+        setProgramInputsForVectorList(program, good, vectors + first, nLanes);
+        runCircuitProgramWithFault(program, good, -1, 0);
+        for(i = 0; i < sim->nResponses; i++) {
+            syndrome = syndromes + i * dict->syndromeWords;
+            memcpy(faulty, good, inputWords * sizeof(TruthWord));
+            runCircuitProgramWithFault(program, faulty, sim->responses[i].valveNo, 
+                    sim->responses[i].fault == SA1);
+            for(j = program->nInputs; j < program->nTps; j++) {
+                for(lane = 0; lane < nLanes; lane++) {
+                    diff = good[program->tpRegisters[j] * PROGRAM_BLOCK_WORDS + lane / TRUTH_WORD_BITS] ^ 
+                        faulty[program->tpRegisters[j] * PROGRAM_BLOCK_WORDS + lane / TRUTH_WORD_BITS];
+                    if((diff >> (lane % TRUTH_WORD_BITS)) & 1) {
+                        addSyndromeFailure(dict, syndrome, first + lane, j);
+                    }
+                }
+            }
+        }
+    }
+    free(good);
+    free(faulty);
+    
+    passFailWords = getWordsForBits(nVectors) + 1;
+    assert((passFail = malloc(passFailWords * sizeof(TruthWord))) != NULL);
+    for(i = 0; i < sim->nResponses; i++) {
+        syndrome = syndromes + i * dict->syndromeWords;
+        addFaultToClass(&dict->classes, &dict->nClasses, dict->classIndices, 
+                dict->faultClasses, i, syndrome, dict->syndromeWords);
+        memset(passFail, 0, passFailWords * sizeof(TruthWord));
+        for(lane = 0; lane < nVectors; lane++) {
+            for(j = 0; j < dict->tpWords; j++) {
+                if(syndrome[lane * dict->tpWords + j]) {
+                    passFail[lane / TRUTH_WORD_BITS] |= ((TruthWord) 1) << (lane % TRUTH_WORD_BITS);
+                    break;
+                }
+            }
+        }
+        addFaultToClass(&dict->passFailClasses, &dict->nPassFailClasses, dict->passFailIndices, 
+                dict->faultPassFailClasses, i, passFail, passFailWords);
+    }
+    free(passFail);
+    free(syndromes);
+    return dict;
+}
+
+void freeFaultClasses(FaultClass* classes, int nClasses) {
+    int i;
+    for(i = 0; i < nClasses; i++) {
+        free(classes[i].faults);
+    }
+    free(classes);
+}
+
+void freeFaultDictionary(FaultDictionary* dict) {
+    if(dict != NULL) {
+        free(dict->vectors);
+        freeHashIndex(dict->vectorIndices);
+        freeFaultClasses(dict->classes, dict->nClasses);
+        freeHashIndex(dict->classIndices);
+        free(dict->faultClasses);
+        freeFaultClasses(dict->passFailClasses, dict->nPassFailClasses);
+        freeHashIndex(dict->passFailIndices);
+        free(dict->faultPassFailClasses);
+        free(dict);
+    }
+}
+
+FaultClass* getFaultClass(FaultDictionary* dict, int valveNo, CircuitFault fault) {
+    FaultResponse* response = getFaultResponse(dict->sim, valveNo, fault);
+    if(response == NULL) {
+        return NULL;
+    }
+    return &dict->classes[dict->faultClasses[response - dict->sim->responses]];
+}
+
+/*
+ * The node only reports valves, not which TPs failed, so observed failures
+ * are diagnosed on the pass/fail dictionary: a bit per dictionary vector
+ */
+TruthWord* createFailingVectors(FaultDictionary* dict) {
+    TruthWord* failingVectors;
+    assert((failingVectors = calloc(getWordsForBits(dict->nVectors) + 1, sizeof(TruthWord))) != NULL);
+    return failingVectors;
+}
+
+void clearFailingVectors(FaultDictionary* dict, TruthWord* failingVectors) {
+    memset(failingVectors, 0, (getWordsForBits(dict->nVectors) + 1) * sizeof(TruthWord));
+}
+
+/*
+ * Returns -1 if the vector is not one the dictionary was built over
+ */
+int addFailingVector(FaultDictionary* dict, TruthWord* failingVectors, int vector) {
+    int pos = hashIndexGetInt(dict->vectorIndices, vector);
+    if(pos < 0) {
+        return -1;
+    }
+    failingVectors[pos / TRUTH_WORD_BITS] |= ((TruthWord) 1) << (pos % TRUTH_WORD_BITS);
+    return 0;
+}
+
+FaultClass* diagnoseFailingVectors(FaultDictionary* dict, TruthWord* failingVectors) {
+    int index = hashIndexGet(dict->passFailIndices, failingVectors, 
+            (getWordsForBits(dict->nVectors) + 1) * sizeof(TruthWord));
+    return index < 0 ? NULL : &dict->passFailClasses[index];
+}
+
+int isFaultInClass(FaultDictionary* dict, FaultClass* faultClass, int valveNo, CircuitFault fault) {
+    FaultResponse* response;
+    int i;
+    for(i = 0; i < faultClass->nFaults; i++) {
+        response = &dict->sim->responses[faultClass->faults[i]];
+        if(response->valveNo == valveNo && response->fault == fault) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int areFaultsEquivalent(FaultDictionary* dict, int valveNo1, CircuitFault fault1, 
+        int valveNo2, CircuitFault fault2) {
+    FaultClass* class1 = getFaultClass(dict, valveNo1, fault1);
+    return class1 != NULL && class1 == getFaultClass(dict, valveNo2, fault2);
+}
+
+void printFaultDictionary(FaultDictionary* dict) {
+    int i, nColumns, maxCellStringLen;
+    char** columns;
+    char*** rows;
+    assert(dict != NULL);
+    
+    maxCellStringLen = 16;
+    nColumns = 4;
+    assert((columns = malloc(sizeof(char*) * nColumns)) != NULL);
+    columns[0] = TABLE_VECTORS_HEADING;
+    columns[1] = TABLE_FAULTS_HEADING;
+    columns[2] = TABLE_CLASSES_HEADING;
+    columns[3] = TABLE_PASS_FAIL_CLASSES_HEADING;
+    assert((rows = malloc(sizeof(char**))) != NULL);
+    assert((rows[0] = malloc(sizeof(char*) * nColumns)) != NULL);
+    for(i = 0; i < nColumns; i++) {
+        assert((rows[0][i] = malloc(sizeof(char) * maxCellStringLen)) != NULL);
+    }
+    snprintf(rows[0][0], maxCellStringLen, "%d", dict->nVectors);
+    snprintf(rows[0][1], maxCellStringLen, "%d", dict->sim->nResponses);
+    snprintf(rows[0][2], maxCellStringLen, "%d", dict->nClasses);
+    snprintf(rows[0][3], maxCellStringLen, "%d", dict->nPassFailClasses);
+    printTable(stdout, TABLE_TITLE, columns, nColumns, rows, 1);
+    for(i = 0; i < nColumns; i++) {
+        free(rows[0][i]);
+    }
+    free(rows[0]);
+    free(rows);
+    free(columns);
+}
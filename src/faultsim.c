@@ -0,0 +1,237 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assertions.h"
+#include "circuit.h"
+#include "faultsim.h"
+#include "hashindex.h"
+#include "program.h"
+#include "tables.h"
+
+#define N_FAULT_MODES 2
+
+#define TABLE_TITLE "Fault Simulation"
+#define TABLE_VALVE_NO_HEADING "Valve No"
+#define TABLE_SA0_HEADING "SA0 Vectors"
+#define TABLE_SA1_HEADING "SA1 Vectors"
+
+int countWordBits(TruthWord word) {
+    int n = 0;
+    while(word) {
+        word &= word - 1;
+        n++;
+    }
+    return n;
+}
+
+/*
+ * Simulates SA0 and SA1 on every valve in the wiring over a list of vectors,
+ * or every input vector without one, recording which of them make at least
+ * one TP deviate from the fault-free circuit. Each pass covers
+ * PROGRAM_BLOCK_VECTORS vectors per fault
+ */
+FaultSimulation* simulateValveFaultsOnVectors(CircuitProgram* program, Wiring* wiring, 
+        const int* vectors, int nVectors) {
+    FaultSimulation* sim;
+    FaultResponse* response;
+    TruthWord* good;
+    TruthWord* faulty;
+    TruthWord* goodReg;
+    TruthWord* faultyReg;
+    TruthWord detected;
+    int i, j, w, first, word, nLanes, inputWords;
+    assert(program != NULL);
+    assert(wiring != NULL);
+    
+    sim = malloc(sizeof(FaultSimulation));
+    sim->vectors = NULL;
+    sim->vectorIndices = NULL;
+    sim->nVectors = vectors != NULL ? nVectors : 1 << program->nInputs;
+    if(vectors != NULL) {
+        assert((sim->vectors = malloc((nVectors + 1) * sizeof(int))) != NULL);
+        memcpy(sim->vectors, vectors, nVectors * sizeof(int));
+        sim->vectorIndices = createHashIndex(nVectors);
+        for(i = 0; i < nVectors; i++) {
+            hashIndexPutInt(sim->vectorIndices, vectors[i], i);
+        }
+    }
+    sim->nWords = (sim->nVectors + TRUTH_WORD_BITS - 1) / TRUTH_WORD_BITS;
+    sim->nResponses = wiring->nValves * N_FAULT_MODES;
+    assert((sim->responses = malloc(sim->nResponses * sizeof(FaultResponse))) != NULL);
+    sim->valveIndices = createHashIndex(wiring->nValves);
+    for(i = 0; i < wiring->nValves; i++) {
+        hashIndexPutInt(sim->valveIndices, wiring->valves[i]->number, i);
+    }
+    for(i = 0; i < sim->nResponses; i++) {
+        response = &sim->responses[i];
+        response->valveNo = wiring->valves[i / N_FAULT_MODES]->number;
+        response->fault = i % N_FAULT_MODES == 0 ? SA0 : SA1;
+        assert((response->detectingVectors = calloc(sim->nWords, sizeof(TruthWord))) != NULL);
+        response->nDetectingVectors = 0;
+    }
+    
+    good = createProgramRegisters(program);
+    faulty = createProgramRegisters(program);
+    inputWords = program->nInputs * PROGRAM_BLOCK_WORDS;
+    for(first = 0; first < sim->nVectors; first += PROGRAM_BLOCK_VECTORS) {
+        if(vectors != NULL) {
+            nLanes = sim->nVectors - first < PROGRAM_BLOCK_VECTORS ? sim->nVectors - first : PROGRAM_BLOCK_VECTORS;
+            setProgramInputsForVectorList(program, good, vectors + first, nLanes);
+        } else {
+            setProgramInputsForVectors(program, good, first);
+        }
+        runCircuitProgramWithFault(program, good, -1, 0);
+        for(i = 0; i < sim->nResponses; i++) {
+            response = &sim->responses[i];
+            memcpy(faulty, good, inputWords * sizeof(TruthWord));
+            runCircuitProgramWithFault(program, faulty, response->valveNo, response->fault == SA1);
+            for(w = 0; w < PROGRAM_BLOCK_WORDS; w++) {
+                word = first / TRUTH_WORD_BITS + w;
+                if(word >= sim->nWords) {
+                    break;
+                }
+                detected = 0;
+                for(j = program->nInputs; j < program->nTps; j++) {
+                    goodReg = good + program->tpRegisters[j] * PROGRAM_BLOCK_WORDS;
+                    faultyReg = faulty + program->tpRegisters[j] * PROGRAM_BLOCK_WORDS;
+                    detected |= goodReg[w] ^ faultyReg[w];
+                }
+                // The last word is only partly filled when the vectors run out
+                nLanes = sim->nVectors - word * TRUTH_WORD_BITS;
+                if(nLanes < TRUTH_WORD_BITS) {
+                    detected &= (((TruthWord) 1) << nLanes) - 1;
+                }
+                response->detectingVectors[word] = detected;
+                response->nDetectingVectors += countWordBits(detected);
+            }
+        }
+    }
+    free(good);
+    free(faulty);
+    return sim;
+}
+
+FaultSimulation* simulateValveFaults(CircuitProgram* program, Wiring* wiring) {
+    assert(program != NULL);
+    if(program->nInputs > MAX_TRUTH_TABLE_INPUTS) {
+        fprintf(stderr, "Circuit has too many inputs to simulate every vector, use --atpg to simulate a sample\n");
+        return NULL;
+    }
+    return simulateValveFaultsOnVectors(program, wiring, NULL, 0);
+}
+
+/*
+ * For circuits too wide to simulate every vector, simulates a fixed sample
+ * of nVectors distinct pseudo-random vectors instead. Faults only detected
+ * by vectors outside the sample then look undetectable
+ */
+FaultSimulation* simulateSampledValveFaults(CircuitProgram* program, Wiring* wiring, int nVectors) {
+    FaultSimulation* sim;
+    HashIndex* sampled;
+    int* vectors;
+    unsigned int seed = FAULTSIM_SAMPLE_SEED;
+    int i = 0, vector;
+    assert(program != NULL);
+    if(program->nInputs > FAULTSIM_MAX_SAMPLE_INPUTS) {
+        fprintf(stderr, "Circuit has too many inputs to number its vectors\n");
+        return NULL;
+    }
+    if(nVectors > 1 << program->nInputs) {
+        return simulateValveFaults(program, wiring);
+    }
+    assert((vectors = malloc((nVectors + 1) * sizeof(int))) != NULL);
+    sampled = createHashIndex(nVectors);
+    while(i < nVectors) {
+        vector = (((unsigned int) rand_r(&seed) << 16) ^ rand_r(&seed)) & ((1U << program->nInputs) - 1);
+        if(hashIndexPutInt(sampled, vector, i)) {
+            vectors[i++] = vector;
+        }
+    }
+    freeHashIndex(sampled);
+    sim = simulateValveFaultsOnVectors(program, wiring, vectors, nVectors);
+    free(vectors);
+    return sim;
+}
+
+void freeFaultSimulation(FaultSimulation* sim) {
+    int i;
+    if(sim != NULL) {
+        for(i = 0; i < sim->nResponses; i++) {
+            free(sim->responses[i].detectingVectors);
+        }
+        free(sim->responses);
+        freeHashIndex(sim->valveIndices);
+        free(sim->vectors);
+        freeHashIndex(sim->vectorIndices);
+        free(sim);
+    }
+}
+
+FaultResponse* getFaultResponse(FaultSimulation* sim, int valveNo, CircuitFault fault) {
+    int i;
+    if(sim == NULL || fault == NONE) {
+        return NULL;
+    }
+    i = hashIndexGetInt(sim->valveIndices, valveNo);
+    if(i < 0) {
+        return NULL;
+    }
+    return &sim->responses[i * N_FAULT_MODES + (fault == SA0 ? 0 : 1)];
+}
+
+int getSimulatedVector(FaultSimulation* sim, int index) {
+    return sim->vectors != NULL ? sim->vectors[index] : index;
+}
+
+/*
+ * Whether the index-th simulated vector detects the fault
+ */
+int isDetectingVectorIndex(FaultResponse* response, int index) {
+    return getTruthTableValue(response->detectingVectors, index);
+}
+
+/*
+ * Whether a vector detects the fault, counting vectors outside a sampled
+ * simulation as not detecting it
+ */
+int isDetectingVector(FaultSimulation* sim, FaultResponse* response, int vector) {
+    int index = sim->vectors != NULL ? hashIndexGetInt(sim->vectorIndices, vector) : vector;
+    return index >= 0 && isDetectingVectorIndex(response, index);
+}
+
+void printFaultSimulation(FaultSimulation* sim) {
+    int i, j, maxCellStringLen, nColumns, nRows;
+    char** columns;
+    char*** rows;
+    assert(sim != NULL);
+    
+    maxCellStringLen = 32;
+    nColumns = 3;
+    assert((columns = malloc(sizeof(char*) * nColumns)) != NULL);
+    columns[0] = TABLE_VALVE_NO_HEADING;
+    columns[1] = TABLE_SA0_HEADING;
+    columns[2] = TABLE_SA1_HEADING;
+    nRows = sim->nResponses / N_FAULT_MODES;
+    assert((rows = malloc(sizeof(char**) * nRows)) != NULL);
+    for(i = 0; i < nRows; i++) {
+        rows[i] = malloc(sizeof(char*) * nColumns);
+        for(j = 0; j < nColumns; j++) {
+            rows[i][j] = malloc(sizeof(char) * maxCellStringLen);
+        }
+        snprintf(rows[i][0], maxCellStringLen, "%d", sim->responses[i * N_FAULT_MODES].valveNo);
+        snprintf(rows[i][1], maxCellStringLen, "%d/%d", 
+                sim->responses[i * N_FAULT_MODES].nDetectingVectors, sim->nVectors);
+        snprintf(rows[i][2], maxCellStringLen, "%d/%d", 
+                sim->responses[i * N_FAULT_MODES + 1].nDetectingVectors, sim->nVectors);
+    }
+    printTable(stdout, TABLE_TITLE, columns, nColumns, rows, nRows);
+    for(i = 0; i < nRows; i++) {
+        for(j = 0; j < nColumns; j++) {
+            free(rows[i][j]);
+        }
+        free(rows[i]);
+    }
+    free(rows);
+    free(columns);
+}
@@ -0,0 +1,246 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#ifdef GPIO_WIRINGPI
+#include <wiringPi.h>
+#endif
+#include "gpio.h"
+
+/*
+ * BCM GPIO numbers of the pins on the 40 pin header of every Pi since the
+ * model B revision 2, indexed by physical pin, or -1 for power and ground
+ */
+static const int headerPinGpios[GPIO_HEADER_PINS + 1] = {
+    -1,
+    -1, -1, 2, -1, 3, -1, 4, 14, -1, 15,
+    17, 18, 27, -1, 22, 23, -1, 24, 10, -1,
+    9, 25, 11, 8, -1, 7, 0, 1, 5, -1,
+    6, 12, 13, -1, 19, 16, 26, 20, -1, 21
+};
+
+int getGpioOfHeaderPin(int pin) {
+    if(pin < 1 || pin > GPIO_HEADER_PINS) {
+        return -1;
+    }
+    return headerPinGpios[pin];
+}
+
+int getGpioBackendByName(const char* name, GpioBackendType* type) {
+    if(strcmp(name, GPIO_BACKEND_WIRINGPI_NAME) == 0) {
+        *type = GPIO_BACKEND_WIRINGPI;
+    } else if(strcmp(name, GPIO_BACKEND_GPIOCHAR_NAME) == 0) {
+        *type = GPIO_BACKEND_GPIOCHAR;
+    } else if(strcmp(name, GPIO_BACKEND_MOCK_NAME) == 0) {
+        *type = GPIO_BACKEND_MOCK;
+    } else {
+        fprintf(stderr, "Unknown GPIO backend \"%s\"\n", name);
+        return -1;
+    }
+#ifndef GPIO_WIRINGPI
+    if(*type == GPIO_BACKEND_WIRINGPI) {
+        fprintf(stderr, "Built without wiringPi, rebuild with GPIO=%s\n", GPIO_BACKEND_WIRINGPI_NAME);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+#ifdef GPIO_WIRINGPI
+int requestWiringPiOutputs(GpioBackend* gpio) {
+    int i;
+    for(i = 0; i < gpio->nPins; i++) {
+        pinMode(gpio->pins[i], OUTPUT);
+    }
+    return 0;
+}
+
+int writeWiringPiOutputs(GpioBackend* gpio) {
+    int i;
+    for(i = 0; i < gpio->nPins; i++) {
+        if(gpio->levels[i] != gpio->written[i]) {
+            digitalWrite(gpio->pins[i], gpio->levels[i] ? HIGH : LOW);
+        }
+    }
+    return 0;
+}
+#endif
+
+/*
+ * A line request covers at most GPIO_V2_LINES_MAX lines, so the outputs are
+ * split over as few requests as that allows
+ */
+int requestGpiocharOutputs(GpioBackend* gpio) {
+    struct gpio_v2_line_request request;
+    int i, j, first;
+    gpio->nLineFds = (gpio->nPins + GPIO_V2_LINES_MAX - 1) / GPIO_V2_LINES_MAX;
+    assert((gpio->lineFds = malloc((gpio->nLineFds + 1) * sizeof(int))) != NULL);
+    for(i = 0; i < gpio->nLineFds; i++) {
+        gpio->lineFds[i] = -1;
+    }
+    for(i = 0; i < gpio->nLineFds; i++) {
+        first = i * GPIO_V2_LINES_MAX;
+        memset(&request, 0, sizeof(request));
+        for(j = 0; j < GPIO_V2_LINES_MAX && first + j < gpio->nPins; j++) {
+            request.offsets[j] = gpio->pins[first + j];
+        }
+        request.num_lines = j;
+        strncpy(request.consumer, GPIO_CONSUMER_NAME, GPIO_MAX_NAME_SIZE - 1);
+        request.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+        if(ioctl(gpio->chipFd, GPIO_V2_GET_LINE_IOCTL, &request) < 0) {
+            fprintf(stderr, "Could not request GPIO lines as outputs: %s\n", strerror(errno));
+            return -1;
+        }
+        gpio->lineFds[i] = request.fd;
+    }
+    return 0;
+}
+
+int writeGpiocharOutputs(GpioBackend* gpio) {
+    struct gpio_v2_line_values values;
+    int i, j, first;
+    for(i = 0; i < gpio->nLineFds; i++) {
+        first = i * GPIO_V2_LINES_MAX;
+        values.bits = 0;
+        values.mask = 0;
+        for(j = 0; j < GPIO_V2_LINES_MAX && first + j < gpio->nPins; j++) {
+            values.mask |= ((uint64_t) 1) << j;
+            if(gpio->levels[first + j]) {
+                values.bits |= ((uint64_t) 1) << j;
+            }
+        }
+        if(ioctl(gpio->lineFds[i], GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0) {
+            fprintf(stderr, "Could not set GPIO lines: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void releaseGpiocharOutputs(GpioBackend* gpio) {
+    int i;
+    for(i = 0; i < gpio->nLineFds; i++) {
+        if(gpio->lineFds[i] >= 0) {
+            close(gpio->lineFds[i]);
+        }
+    }
+    free(gpio->lineFds);
+    gpio->lineFds = NULL;
+    gpio->nLineFds = 0;
+}
+
+int requestMockOutputs(GpioBackend* gpio) {
+    return 0;
+}
+
+int writeMockOutputs(GpioBackend* gpio) {
+    return 0;
+}
+
+GpioBackend* createGpioBackend(GpioBackendType type, const char* chip) {
+    GpioBackend* gpio = malloc(sizeof(GpioBackend));
+    gpio->type = type;
+    gpio->requestOutputs = requestMockOutputs;
+    gpio->writeOutputs = writeMockOutputs;
+    gpio->release = NULL;
+    gpio->pins = NULL;
+    gpio->levels = NULL;
+    gpio->written = NULL;
+    gpio->nPins = 0;
+    gpio->chipFd = -1;
+    gpio->lineFds = NULL;
+    gpio->nLineFds = 0;
+    gpio->nWrites = 0;
+    switch(type) {
+#ifdef GPIO_WIRINGPI
+        case GPIO_BACKEND_WIRINGPI: {
+            if(wiringPiSetupGpio() < 0) {
+                fprintf(stderr, "Could not set up wiringPi\n");
+                free(gpio);
+                return NULL;
+            }
+            gpio->requestOutputs = requestWiringPiOutputs;
+            gpio->writeOutputs = writeWiringPiOutputs;
+            break;
+        }
+#endif
+        case GPIO_BACKEND_GPIOCHAR: {
+            gpio->chipFd = open(chip, O_RDWR | O_CLOEXEC);
+            if(gpio->chipFd < 0) {
+                fprintf(stderr, "Could not open GPIO chip \"%s\"\n", chip);
+                free(gpio);
+                return NULL;
+            }
+            gpio->requestOutputs = requestGpiocharOutputs;
+            gpio->writeOutputs = writeGpiocharOutputs;
+            gpio->release = releaseGpiocharOutputs;
+            break;
+        }
+        case GPIO_BACKEND_MOCK: {
+            break;
+        }
+        default: {
+            fprintf(stderr, "GPIO backend %d is not available\n", type);
+            free(gpio);
+            return NULL;
+        }
+    }
+    return gpio;
+}
+
+void freeGpioBackend(GpioBackend* gpio) {
+    if(gpio != NULL) {
+        if(gpio->release != NULL) {
+            gpio->release(gpio);
+        }
+        if(gpio->chipFd >= 0) {
+            close(gpio->chipFd);
+        }
+        free(gpio->pins);
+        free(gpio->levels);
+        free(gpio->written);
+        free(gpio);
+    }
+}
+
+/*
+ * Claims the pins as outputs, all initially low. Their indices in pins are
+ * the indices used to set them afterwards
+ */
+int requestGpioOutputs(GpioBackend* gpio, const int* pins, int nPins) {
+    assert(gpio->pins == NULL);
+    assert((gpio->pins = malloc((nPins + 1) * sizeof(int))) != NULL);
+    memcpy(gpio->pins, pins, nPins * sizeof(int));
+    assert((gpio->levels = calloc(nPins + 1, sizeof(uint8_t))) != NULL);
+    assert((gpio->written = malloc((nPins + 1) * sizeof(uint8_t))) != NULL);
+    // Nothing is known about the lines yet, so the first write sets all of them
+    memset(gpio->written, UINT8_MAX, nPins);
+    gpio->nPins = nPins;
+    if(gpio->requestOutputs(gpio) < 0) {
+        return -1;
+    }
+    return writeGpioOutputs(gpio);
+}
+
+void setGpioOutput(GpioBackend* gpio, int index, int level) {
+    assert(index >= 0 && index < gpio->nPins);
+    gpio->levels[index] = level != 0;
+}
+
+/*
+ * Drives every output to the level last set for it
+ */
+int writeGpioOutputs(GpioBackend* gpio) {
+    if(gpio->writeOutputs(gpio) < 0) {
+        return -1;
+    }
+    memcpy(gpio->written, gpio->levels, gpio->nPins);
+    gpio->nWrites++;
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashindex.h"
+
+#define MIN_CAPACITY 16
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+unsigned int getHashOfBytes(const void* key, int keyLen) {
+    const unsigned char* bytes = key;
+    int i;
+    unsigned int hash = FNV_OFFSET_BASIS;
+    for(i = 0; i < keyLen; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+void allocHashIndexSlots(HashIndex* index, int capacity) {
+    index->capacity = capacity;
+    assert((index->keys = calloc(capacity, sizeof(unsigned char*))) != NULL);
+    assert((index->keyLens = malloc(capacity * sizeof(int))) != NULL);
+    assert((index->hashes = malloc(capacity * sizeof(unsigned int))) != NULL);
+    assert((index->values = malloc(capacity * sizeof(int))) != NULL);
+}
+
+HashIndex* createHashIndex(int expectedSize) {
+    HashIndex* index = malloc(sizeof(HashIndex));
+    int capacity = MIN_CAPACITY;
+    // Keep the load factor at or below one half
+    while(capacity < expectedSize * 2) {
+        capacity *= 2;
+    }
+    allocHashIndexSlots(index, capacity);
+    index->n = 0;
+    return index;
+}
+
+void freeHashIndexSlots(HashIndex* index) {
+    int i;
+    for(i = 0; i < index->capacity; i++) {
+        free(index->keys[i]);
+    }
+    free(index->keys);
+    free(index->keyLens);
+    free(index->hashes);
+    free(index->values);
+}
+
+void freeHashIndex(HashIndex* index) {
+    if(index != NULL) {
+        freeHashIndexSlots(index);
+        free(index);
+    }
+}
+
+int findHashIndexSlot(HashIndex* index, const unsigned char* key, int keyLen, unsigned int hash) {
+    int slot = hash & (index->capacity - 1);
+    while(index->keys[slot] != NULL) {
+        if(index->hashes[slot] == hash && index->keyLens[slot] == keyLen &&
+                memcmp(index->keys[slot], key, keyLen) == 0) {
+            break;
+        }
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+    return slot;
+}
+
+void growHashIndex(HashIndex* index) {
+    HashIndex old = *index;
+    int i, slot;
+    allocHashIndexSlots(index, old.capacity * 2);
+    for(i = 0; i < old.capacity; i++) {
+        if(old.keys[i] != NULL) {
+            slot = findHashIndexSlot(index, old.keys[i], old.keyLens[i], old.hashes[i]);
+            index->keys[slot] = old.keys[i];
+            index->keyLens[slot] = old.keyLens[i];
+            index->hashes[slot] = old.hashes[i];
+            index->values[slot] = old.values[i];
+            old.keys[i] = NULL;
+        }
+    }
+    freeHashIndexSlots(&old);
+}
+
+/*
+ * Returns 1 if the key was added, or 0 if it was already present, in which
+ * case the existing value is left unchanged
+ */
+int hashIndexPut(HashIndex* index, const void* key, int keyLen, int value) {
+    unsigned int hash = getHashOfBytes(key, keyLen);
+    int slot = findHashIndexSlot(index, key, keyLen, hash);
+    if(index->keys[slot] != NULL) {
+        return 0;
+    }
+    assert((index->keys[slot] = malloc(keyLen > 0 ? keyLen : 1)) != NULL);
+    memcpy(index->keys[slot], key, keyLen);
+    index->keyLens[slot] = keyLen;
+    index->hashes[slot] = hash;
+    index->values[slot] = value;
+    index->n++;
+    if(index->n * 2 > index->capacity) {
+        growHashIndex(index);
+    }
+    return 1;
+}
+
+int hashIndexGet(HashIndex* index, const void* key, int keyLen) {
+    int slot = findHashIndexSlot(index, key, keyLen, getHashOfBytes(key, keyLen));
+    if(index->keys[slot] == NULL) {
+        return -1;
+    }
+    return index->values[slot];
+}
+
+int hashIndexPutStr(HashIndex* index, const char* key, int value) {
+    return hashIndexPut(index, key, strlen(key), value);
+}
+
+int hashIndexGetStr(HashIndex* index, const char* key) {
+    return hashIndexGet(index, key, strlen(key));
+}
+
+int hashIndexPutInt(HashIndex* index, int key, int value) {
+    return hashIndexPut(index, &key, sizeof(int), value);
+}
+
+int hashIndexGetInt(HashIndex* index, int key) {
+    return hashIndexGet(index, &key, sizeof(int));
+}
@@ -0,0 +1,236 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "circuit.h"
+#include "hashindex.h"
+#include "latency.h"
+#include "tables.h"
+
+#define SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define HALF_SUB_BUCKETS (SUB_BUCKETS / 2)
+
+#define TABLE_TITLE "Report Latency (ms)"
+#define TABLE_VALVE_NO_HEADING "Valve No"
+#define TABLE_FAULT_HEADING "Fault"
+#define TABLE_COUNT_HEADING "Reports"
+#define TABLE_MIN_HEADING "Min"
+#define TABLE_P50_HEADING "p50"
+#define TABLE_P90_HEADING "p90"
+#define TABLE_P99_HEADING "p99"
+#define TABLE_MAX_HEADING "Max"
+#define ALL_VALVES "All"
+
+const char* LATENCY_FAULT_NAMES[] = { "None", "SA0", "SA1" };
+
+int getLatencyBucket(int64_t value) {
+    int msb, shift;
+    if(value < SUB_BUCKETS) {
+        return value < 0 ? 0 : value;
+    }
+    msb = 63 - __builtin_clzll(value);
+    shift = msb - (LATENCY_SUB_BUCKET_BITS - 1);
+    return SUB_BUCKETS + (shift - 1) * HALF_SUB_BUCKETS + (int) ((value >> shift) - HALF_SUB_BUCKETS);
+}
+
+int64_t getLatencyBucketValue(int bucket) {
+    int shift;
+    if(bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    shift = (bucket - SUB_BUCKETS) / HALF_SUB_BUCKETS + 1;
+    return ((int64_t) ((bucket - SUB_BUCKETS) % HALF_SUB_BUCKETS + HALF_SUB_BUCKETS)) << shift;
+}
+
+LatencyHistogram* createLatencyHistogram() {
+    LatencyHistogram* histogram = malloc(sizeof(LatencyHistogram));
+    histogram->nBuckets = getLatencyBucket((((int64_t) 1) << LATENCY_MAX_BITS) - 1) + 1;
+    assert((histogram->counts = calloc(histogram->nBuckets, sizeof(uint64_t))) != NULL);
+    histogram->total = 0;
+    histogram->min = INT64_MAX;
+    histogram->max = 0;
+    return histogram;
+}
+
+void freeLatencyHistogram(LatencyHistogram* histogram) {
+    if(histogram != NULL) {
+        free(histogram->counts);
+        free(histogram);
+    }
+}
+
+void recordLatency(LatencyHistogram* histogram, int64_t latencyUs) {
+    int bucket = getLatencyBucket(latencyUs);
+    if(bucket >= histogram->nBuckets) {
+        bucket = histogram->nBuckets - 1;
+    }
+    histogram->counts[bucket]++;
+    histogram->total++;
+    histogram->min = latencyUs < histogram->min ? latencyUs : histogram->min;
+    histogram->max = latencyUs > histogram->max ? latencyUs : histogram->max;
+}
+
+/*
+ * Returns the lowest value of the bucket holding the given percentile
+ */
+int64_t getLatencyPercentile(LatencyHistogram* histogram, double percentile) {
+    uint64_t seen = 0, target;
+    int i;
+    if(histogram->total == 0) {
+        return 0;
+    }
+    target = (uint64_t) (percentile / 100.0 * histogram->total + 0.5);
+    target = target < 1 ? 1 : target;
+    for(i = 0; i < histogram->nBuckets; i++) {
+        seen += histogram->counts[i];
+        if(seen >= target) {
+            return getLatencyBucketValue(i);
+        }
+    }
+    return histogram->max;
+}
+
+LatencyHistograms* createLatencyHistograms() {
+    LatencyHistograms* histograms = malloc(sizeof(LatencyHistograms));
+    int i;
+    histograms->histograms = NULL;
+    histograms->valveNos = NULL;
+    histograms->faults = NULL;
+    histograms->n = 0;
+    histograms->indices = createHashIndex(0);
+    for(i = 0; i <= SA1; i++) {
+        histograms->faultHistograms[i] = createLatencyHistogram();
+    }
+    return histograms;
+}
+
+void freeLatencyHistograms(LatencyHistograms* histograms) {
+    int i;
+    if(histograms != NULL) {
+        for(i = 0; i < histograms->n; i++) {
+            freeLatencyHistogram(histograms->histograms[i]);
+        }
+        for(i = 0; i <= SA1; i++) {
+            freeLatencyHistogram(histograms->faultHistograms[i]);
+        }
+        free(histograms->histograms);
+        free(histograms->valveNos);
+        free(histograms->faults);
+        freeHashIndex(histograms->indices);
+        free(histograms);
+    }
+}
+
+void recordValveLatency(LatencyHistograms* histograms, int valveNo, CircuitFault fault, int64_t latencyUs) {
+    int key[2] = { valveNo, fault };
+    int i = hashIndexGet(histograms->indices, key, sizeof(key));
+    if(i < 0) {
+        i = histograms->n++;
+        histograms->histograms = realloc(histograms->histograms, histograms->n * sizeof(LatencyHistogram*));
+        histograms->valveNos = realloc(histograms->valveNos, histograms->n * sizeof(int));
+        histograms->faults = realloc(histograms->faults, histograms->n * sizeof(CircuitFault));
+        histograms->histograms[i] = createLatencyHistogram();
+        histograms->valveNos[i] = valveNo;
+        histograms->faults[i] = fault;
+        hashIndexPut(histograms->indices, key, sizeof(key), i);
+    }
+    recordLatency(histograms->histograms[i], latencyUs);
+    recordLatency(histograms->faultHistograms[fault], latencyUs);
+}
+
+void fillLatencyRow(char** row, int maxCellStringLen, const char* valve, CircuitFault fault, 
+        LatencyHistogram* histogram) {
+    snprintf(row[0], maxCellStringLen, "%s", valve);
+    snprintf(row[1], maxCellStringLen, "%s", LATENCY_FAULT_NAMES[fault]);
+    snprintf(row[2], maxCellStringLen, "%llu", (unsigned long long) histogram->total);
+    snprintf(row[3], maxCellStringLen, "%.3f", histogram->min / 1000.0);
+    snprintf(row[4], maxCellStringLen, "%.3f", getLatencyPercentile(histogram, 50) / 1000.0);
+    snprintf(row[5], maxCellStringLen, "%.3f", getLatencyPercentile(histogram, 90) / 1000.0);
+    snprintf(row[6], maxCellStringLen, "%.3f", getLatencyPercentile(histogram, 99) / 1000.0);
+    snprintf(row[7], maxCellStringLen, "%.3f", histogram->max / 1000.0);
+}
+
+void printLatencyHistograms(LatencyHistograms* histograms) {
+    int i, j, maxCellStringLen, nColumns, nRows = 0;
+    char** columns;
+    char*** rows;
+    char valve[16];
+    assert(histograms != NULL);
+    
+    maxCellStringLen = 32;
+    nColumns = 8;
+    assert((columns = malloc(sizeof(char*) * nColumns)) != NULL);
+    columns[0] = TABLE_VALVE_NO_HEADING;
+    columns[1] = TABLE_FAULT_HEADING;
+    columns[2] = TABLE_COUNT_HEADING;
+    columns[3] = TABLE_MIN_HEADING;
+    columns[4] = TABLE_P50_HEADING;
+    columns[5] = TABLE_P90_HEADING;
+    columns[6] = TABLE_P99_HEADING;
+    columns[7] = TABLE_MAX_HEADING;
+    assert((rows = malloc(sizeof(char**) * (histograms->n + SA1 + 1))) != NULL);
+    for(i = 0; i < histograms->n + SA1 + 1; i++) {
+        rows[i] = malloc(sizeof(char*) * nColumns);
+        for(j = 0; j < nColumns; j++) {
+            rows[i][j] = malloc(sizeof(char) * maxCellStringLen);
+        }
+    }
+    for(i = 0; i < histograms->n; i++) {
+        snprintf(valve, sizeof(valve), "%d", histograms->valveNos[i]);
+        fillLatencyRow(rows[nRows++], maxCellStringLen, valve, histograms->faults[i], histograms->histograms[i]);
+    }
+    for(i = 0; i <= SA1; i++) {
+        if(histograms->faultHistograms[i]->total > 0) {
+            fillLatencyRow(rows[nRows++], maxCellStringLen, ALL_VALVES, i, histograms->faultHistograms[i]);
+        }
+    }
+    printTable(stdout, TABLE_TITLE, columns, nColumns, rows, nRows);
+    for(i = 0; i < histograms->n + SA1 + 1; i++) {
+        for(j = 0; j < nColumns; j++) {
+            free(rows[i][j]);
+        }
+        free(rows[i]);
+    }
+    free(rows);
+    free(columns);
+}
+
+void writeLatencyHistogram(FILE* file, const char* valve, CircuitFault fault, LatencyHistogram* histogram) {
+    uint64_t seen = 0;
+    int i;
+    fprintf(file, "# Valve %s %s\n", valve, LATENCY_FAULT_NAMES[fault]);
+    fprintf(file, "%12s %12s %10s\n", "Value(ms)", "Percentile", "TotalCount");
+    for(i = 0; i < histogram->nBuckets; i++) {
+        if(histogram->counts[i] > 0) {
+            seen += histogram->counts[i];
+            fprintf(file, "%12.3f %12.6f %10llu\n", getLatencyBucketValue(i) / 1000.0, 
+                    (double) seen / histogram->total, (unsigned long long) seen);
+        }
+    }
+    fprintf(file, "\n");
+}
+
+/*
+ * Writes the cumulative distribution of every histogram with any reports
+ */
+int writeLatencyHistograms(const char* filename, LatencyHistograms* histograms) {
+    FILE* file = fopen(filename, "w");
+    char valve[16];
+    int i;
+    if(file == NULL) {
+        fprintf(stderr, "Could not write latencies to %s\n", filename);
+        return -1;
+    }
+    for(i = 0; i < histograms->n; i++) {
+        snprintf(valve, sizeof(valve), "%d", histograms->valveNos[i]);
+        writeLatencyHistogram(file, valve, histograms->faults[i], histograms->histograms[i]);
+    }
+    for(i = 0; i <= SA1; i++) {
+        if(histograms->faultHistograms[i]->total > 0) {
+            writeLatencyHistogram(file, ALL_VALVES, i, histograms->faultHistograms[i]);
+        }
+    }
+    fclose(file);
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <limits.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,13 +7,24 @@
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
-#include <wiringPi.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include "network.h"
+#include "aggregator.h"
 #include "assertions.h"
+#include "atpg.h"
+#include "campaign.h"
 #include "circuit.h"
+#include "diagnosis.h"
+#include "faultsim.h"
+#include "gpio.h"
+#include "latency.h"
+#include "program.h"
 #include "serial.h"
+#include "serialwriter.h"
+#include "timeutil.h"
 #include "edsac_representation.h"
 
 #define CIRCUIT_FILNAME "config/circuit.xml"
@@ -26,13 +38,20 @@
 #define SERIAL_DEVICE "/dev/ttyS0"
 #define BAUD_RATE 9600
 #define CYCLE_DELAY_MS 10
+#define LISTEN_MS 200
+#define PIPELINE_DEPTH 1
+#define CONFIRM_LOOKAHEAD 2
+#define CYCLE_DELAY_FILENAME "config/cycle_delay"
+#define CALIBRATION_MAX_DELAY_MS 1000
+#define CALIBRATION_REPEATS 2
+#define N_INJECTIONS_PER_VALVE 3
 
 #define ECHO_ONLY 0
 
-#define N_PARAMS 8
+#define N_PARAMS 25
 #define MAX_ARG_LEN 64
 
-void parseCircuitFile(const char* filename, AssertionsSet** set) {
+void parseCircuitFile(const char* filename, AssertionsSet** set, CircuitProgram** program) {
     xmlDoc *doc = NULL;
     xmlNode *root = NULL;
     doc = xmlReadFile(filename, NULL, 0);
@@ -41,7 +60,11 @@ void parseCircuitFile(const char* filename, AssertionsSet** set) {
         return;
     }
     root = xmlDocGetRootElement(doc);
-    *set = createAssertionSetFromXMLNode(root);
+    // The program evaluates the circuit, so no tables are built for the TPs
+    *set = createUnevaluatedAssertionSetFromXMLNode(root);
+    if(*set != NULL) {
+        *program = compileCircuitProgram(root, *set);
+    }
     
     xmlFreeDoc(doc);
 }
@@ -60,70 +83,820 @@ void parseWiringFile(const char* filename, AssertionsSet* set, Wiring** wiring)
     xmlFreeDoc(doc);
 }
 
-void get(AssertionsSet** set, Wiring** wiring) {
-    parseCircuitFile(CIRCUIT_FILNAME, set);
-    assert(*set != NULL);
-    parseWiringFile(WIRING_FILNAME, *set, wiring);
-    assert(*wiring != NULL);
+void printFaultCandidates(FaultDictionary* dict, int valveNo, CircuitFault fault) {
+    FaultClass* faultClass;
+    FaultResponse* response;
+    int i;
+    if(dict == NULL || (faultClass = getFaultClass(dict, valveNo, fault)) == NULL || faultClass->nFaults <= 1) {
+        return;
+    }
+    printf("Fault is indistinguishable from:");
+    for(i = 0; i < faultClass->nFaults; i++) {
+        response = &dict->sim->responses[faultClass->faults[i]];
+        if(response->valveNo != valveNo || response->fault != fault) {
+            printf(" valve %d SA%d", response->valveNo, response->fault == SA1);
+        }
+    }
+    printf("\n");
 }
 
-void listenForErrorsOn(NetworkHandle* net, time_t since, int valveNo) {
-    Message* rxMsg;
-    int unexpected;
-    int nExpected = 0;
-    while((rxMsg = readNetworkMessage(net, since)) != NULL) {
-        unexpected = false;
-        switch(rxMsg->type) {
-            case HARD_ERROR_VALVE: {
-                if(rxMsg->data.hardware_valve.valve_no != valveNo) {
-                    unexpected = true;
-                    printf("Unexpected hardware other message received %s\n", rxMsg->data.hardware_other.message);
-                } else {
-                    nExpected++;
-                }
-                break;
-            }
-            case HARD_ERROR_OTHER: {
-                unexpected = true;
-                printf("Unexpected hardware other message received %s\n", rxMsg->data.hardware_other.message);
-                break;
+int isEquivalentValve(FaultDictionary* dict, int valveNo, CircuitFault fault, int otherValveNo) {
+    return dict != NULL && (areFaultsEquivalent(dict, valveNo, fault, otherValveNo, SA0) || 
+            areFaultsEquivalent(dict, valveNo, fault, otherValveNo, SA1));
+}
+
+/*
+ * A fault injected on a valve and swept, to which reports are attributed
+ * until listenMs after its last vector was emitted. With a fault simulation,
+ * emitTimes holds when each frame was emitted, and with a fault response
+ * reported marks the frames a report was matched to. With a dictionary,
+ * failingVectors marks the vectors the valve was reported for
+ */
+typedef struct {
+    int valveNo;
+    CircuitFault fault;
+    FaultResponse* response;
+    int nReports;
+    struct timespec started;
+    struct timespec* emitTimes;
+    uint8_t* reported;
+    TruthWord* failingVectors;
+    int nEmitted;
+    struct timespec deadline;
+    int nextFrame;
+    int nExpected;
+    int nUnmatched;
+    int nUnexpected;
+    MessageAggregator* aggregator;
+} Injection;
+
+/*
+ * Up to depth injections are open at once, in the order they were made, so
+ * the reports for one are collected while the next are swept
+ */
+typedef struct {
+    SerialHandle* serial;
+    GpioBackend* gpio;
+    Wiring* wiring;
+    SerialWriter* writer;
+    SerialSweep* sweep;
+    NetworkHandle* net;
+    FaultSimulation* sim;
+    TestSet* testSet;
+    FaultDictionary* dict;
+    int listenMs;
+    int confirmAfter;
+    int minCycleDelayMs;
+    int calibrationRepeats;
+    int calibrationValves;
+    LatencyHistograms* latencies;
+    time_t since;
+    Injection* injections;
+    int depth;
+    int firstOpen;
+    int nOpen;
+} FaultTester;
+
+Injection* getOpenInjection(FaultTester* tester, int i) {
+    return &tester->injections[(tester->firstOpen + i) % tester->depth];
+}
+
+/*
+ * Reports are matched in order to the detecting vectors emitted before them,
+ * returning the matched frame or -1 if no such vector is left
+ */
+int matchReportToFrame(FaultTester* tester, Injection* injection, const struct timespec* received) {
+    SerialSweep* sweep = tester->sweep;
+    int frame;
+    for(; injection->nextFrame < injection->nEmitted; injection->nextFrame++) {
+        frame = injection->nextFrame;
+        if(!isDetectingVector(tester->sim, injection->response, getSerialSweepVector(sweep, frame))) {
+            continue;
+        }
+        if(getTimespecDiffMs(received, &injection->emitTimes[frame]) < 0) {
+            return -1;
+        }
+        injection->nextFrame++;
+        return frame;
+    }
+    return -1;
+}
+
+int isReportForInjection(FaultTester* tester, Injection* injection, Message* msg) {
+    int valveNo;
+    if(msg->type != HARD_ERROR_VALVE || injection->fault == NONE) {
+        return false;
+    }
+    valveNo = msg->data.hardware_valve.valve_no;
+    return valveNo == injection->valveNo || 
+            isEquivalentValve(tester->dict, injection->valveNo, injection->fault, valveNo);
+}
+
+/*
+ * Injections overlap, so a report is told apart by when it arrived and which
+ * vectors had been emitted by then. It goes to the oldest open injection it
+ * could be from with a detecting vector emitted before it that no other
+ * report has been matched to. Anything else goes to the newest injection
+ * started before it arrived, as unexpected. frame is set to the matched
+ * vector, or -1
+ */
+Injection* attributeReport(FaultTester* tester, Message* msg, const struct timespec* received, int* frame) {
+    Injection* injection;
+    Injection* latest = NULL;
+    int i;
+    *frame = -1;
+    for(i = 0; i < tester->nOpen; i++) {
+        injection = getOpenInjection(tester, i);
+        if(injection->nEmitted == 0 || getTimespecDiffMs(received, &injection->started) < 0) {
+            break;
+        }
+        if(compareTimespecs(received, &injection->deadline) > 0) {
+            continue;
+        }
+        latest = injection;
+        if(isReportForInjection(tester, injection, msg)) {
+            if(injection->response == NULL) {
+                return injection;
             }
-            case SOFT_ERROR: {
-                unexpected = true;
-                printf("Unexpected software message received %s\n", rxMsg->data.software.message);
-                break;
+            *frame = matchReportToFrame(tester, injection, received);
+            if(*frame >= 0) {
+                return injection;
             }
-            case KEEP_ALIVE:
-            case INVALID:
-            default: {
-                unexpected = true;
-                printf("Unknown, unexpected message received\n");
+        }
+    }
+    return latest != NULL ? latest : getOpenInjection(tester, 0);
+}
+
+/*
+ * Returns the last frame emitted no later than when, or -1 if there is none
+ */
+int getFrameEmittedBefore(Injection* injection, const struct timespec* when) {
+    int frame;
+    for(frame = injection->nEmitted - 1; frame >= 0; frame--) {
+        if(compareTimespecs(&injection->emitTimes[frame], when) <= 0) {
+            return frame;
+        }
+    }
+    return -1;
+}
+
+/*
+ * A report for the injected valve is only expected if it matched a detecting
+ * vector, when which vectors detect the fault is known. Either way the vector
+ * it was matched to, or else the last one emitted, is counted as failing
+ */
+void recordReport(FaultTester* tester, Message* msg, const struct timespec* received) {
+    Injection* injection;
+    int frame, failingFrame, forInjection;
+    if(tester->nOpen == 0) {
+        free_message(msg);
+        return;
+    }
+    injection = attributeReport(tester, msg, received, &frame);
+    forInjection = isReportForInjection(tester, injection, msg);
+    if(forInjection && injection->failingVectors != NULL) {
+        failingFrame = frame >= 0 ? frame : getFrameEmittedBefore(injection, received);
+        if(failingFrame >= 0) {
+            addFailingVector(tester->dict, injection->failingVectors, 
+                    getSerialSweepVector(tester->sweep, failingFrame));
+        }
+    }
+    if(forInjection && (injection->response == NULL || frame >= 0)) {
+        if(msg->data.hardware_valve.valve_no != injection->valveNo) {
+            // Reported as indistinguishable from the injected fault when aggregated
+            aggregateMessage(injection->aggregator, tester->net, msg, received, false);
+        } else {
+            free_message(msg);
+        }
+        if(frame >= 0) {
+            injection->reported[frame] = true;
+            // Read by the pump up to a poll interval after the report arrived
+            recordValveLatency(tester->latencies, injection->valveNo, injection->fault, 
+                    (int64_t) (getTimespecDiffMs(received, &injection->emitTimes[frame]) * 1000));
+        }
+        injection->nExpected++;
+    } else {
+        injection->nUnmatched += forInjection;
+        injection->nUnexpected++;
+        aggregateMessage(injection->aggregator, tester->net, msg, received, true);
+    }
+}
+
+/*
+ * Looks up which faults fail exactly the vectors the valve was reported for,
+ * and whether the injected fault is one of them
+ */
+void printDiagnosis(FaultTester* tester, Injection* injection) {
+    FaultClass* faultClass = diagnoseFailingVectors(tester->dict, injection->failingVectors);
+    FaultResponse* response;
+    int i;
+    if(injection->nExpected + injection->nUnmatched == 0) {
+        printf("No vector was reported failing for valve %d to diagnose\n", injection->valveNo);
+        return;
+    }
+    if(faultClass == NULL) {
+        printf("No single valve fault fails the vectors reported for valve %d\n", injection->valveNo);
+        return;
+    }
+    printf("Valve %d SA%d diagnosed as:", injection->valveNo, injection->fault == SA1);
+    for(i = 0; i < faultClass->nFaults; i++) {
+        response = &tester->dict->sim->responses[faultClass->faults[i]];
+        printf(" valve %d SA%d", response->valveNo, response->fault == SA1);
+    }
+    if(isFaultInClass(tester->dict, faultClass, injection->valveNo, injection->fault)) {
+        printf(", which includes the injected fault\n");
+    } else {
+        printf(", which does not include the injected fault\n");
+    }
+}
+
+/*
+ * Returns whether exactly the expected reports, and nothing else, arrived
+ */
+int finishInjection(FaultTester* tester, Injection* injection) {
+    SerialSweep* sweep = tester->sweep;
+    int i, nMissing = 0;
+    printf("Results for valve %d simulated with fault=%d\n", injection->valveNo, injection->fault);
+    if(injection->aggregator->n > 0) {
+        printf("Unexpected or indistinguishable messages received:\n");
+        flushMessageAggregator(injection->aggregator, tester->net);
+    }
+    if(injection->fault == NONE) {
+        return injection->nUnexpected == 0;
+    }
+    // A sweep cut short leaves vectors of the dictionary untested
+    if(injection->failingVectors != NULL && injection->nEmitted == sweep->nFrames) {
+        printDiagnosis(tester, injection);
+    }
+    if(injection->nUnmatched > 0) {
+        printf("%d error messages did not follow a vector that should produce one\n", injection->nUnmatched);
+    }
+    if(injection->response != NULL) {
+        if(injection->nExpected == 0 && injection->nReports > 0) {
+            printf("None of the expected error messages were received\n");
+            return false;
+        }
+        for(i = 0; i < injection->nEmitted; i++) {
+            if(isDetectingVector(tester->sim, injection->response, getSerialSweepVector(sweep, i)) && 
+                    !injection->reported[i]) {
+                if(nMissing++ == 0) {
+                    printf("No error message was received for vectors:");
+                }
+                printf(" %d", getSerialSweepVector(sweep, i));
             }
         }
-        if(net->sending && unexpected) {
-            resendNetworkMessage(net, rxMsg);
+        if(nMissing > 0) {
+            printf("\n");
+            return false;
         }
+        return injection->nUnexpected == 0;
     }
-    if(valveNo >= 0 && nExpected <= 0) {
+    // Without a fault simulation any report for the valve will do
+    if(injection->nExpected <= 0) {
         printf("None of the expected error messages were received\n");
+        return false;
     }
+    return injection->nUnexpected == 0;
 }
 
-void testFaults(AssertionsSet* set, Wiring* wiring, SerialHandle* serial, 
-        NetworkHandle* net, int valveNo, CircuitFault fault, int delayMs) {
-    
-    int nCombs, i;
-    time_t timeStarted;
+/*
+ * Attributes reports until the CLOCK_MONOTONIC time until, finishing each
+ * open injection as its deadline passes. Returns how many of those failed
+ */
+int collectReports(FaultTester* tester, const struct timespec* until) {
+    Message* rxMsg;
+    struct timespec received, now, next;
+    int nFailed = 0;
+    while(true) {
+        next = *until;
+        if(tester->nOpen > 0 && compareTimespecs(&getOpenInjection(tester, 0)->deadline, &next) < 0) {
+            next = getOpenInjection(tester, 0)->deadline;
+        }
+        while((rxMsg = waitForNetworkMessage(tester->net, tester->since, &next, &received)) != NULL) {
+            recordReport(tester, rxMsg, &received);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        while(tester->nOpen > 0 && compareTimespecs(&getOpenInjection(tester, 0)->deadline, &now) <= 0) {
+            nFailed += !finishInjection(tester, getOpenInjection(tester, 0));
+            tester->firstOpen = (tester->firstOpen + 1) % tester->depth;
+            tester->nOpen--;
+        }
+        if(compareTimespecs(&now, until) >= 0) {
+            return nFailed;
+        }
+    }
+}
+
+void printSweepTiming(EmittedFrame* first, EmittedFrame* last, double maxLatenessMs, 
+        double totalAckMs, int nAcked, int nFrames) {
+    printf("Emitted %d vectors in %.3fs, at most %.3fms behind schedule\n", nFrames, 
+            getTimespecDiffMs(&last->emitted, &first->emitted) / 1000.0, maxLatenessMs);
+    if(nAcked > 0) {
+        printf("%d of %d vectors acknowledged, taking %.3fms on average\n", nAcked, nFrames, totalAckMs / nAcked);
+    }
+}
+
+/*
+ * Injects a fault and sweeps every vector, holding the fault until the last
+ * vector has been acknowledged or had its cycle. Its reports are collected
+ * while the next faults are swept, once depth are open waiting for the
+ * oldest to finish first. With confirmAfter set, reports are also collected
+ * between vectors and the sweep stops once that many have confirmed the
+ * fault, so only a few vectors are queued ahead. Returns how many injections
+ * failed meanwhile, including this one if the fault could not be set
+ */
+int testFaults(FaultTester* tester, int valveNo, CircuitFault fault) {
+    SerialWriter* writer = tester->writer;
+    SerialSweep* sweep = tester->sweep;
+    Injection* injection;
+    struct timespec hold, now;
+    EmittedFrame first, emitted;
+    double latenessMs, maxLatenessMs = 0, totalAckMs = 0;
+    int i, nFrames = sweep->nFrames, lookahead, nAcked = 0, nFailed = 0;
     
+    if(tester->nOpen == tester->depth) {
+        hold = getOpenInjection(tester, 0)->deadline;
+        nFailed += collectReports(tester, &hold);
+    }
+    injection = getOpenInjection(tester, tester->nOpen);
+    injection->valveNo = valveNo;
+    injection->fault = fault;
+    injection->nReports = -1;
+    injection->nEmitted = 0;
+    injection->nextFrame = 0;
+    injection->nExpected = 0;
+    injection->nUnmatched = 0;
+    injection->nUnexpected = 0;
+    if(injection->reported != NULL) {
+        memset(injection->reported, 0, sweep->nFrames);
+    }
+    if(injection->failingVectors != NULL) {
+        clearFailingVectors(tester->dict, injection->failingVectors);
+    }
     printf("Testing Valve %d simulated with fault=%d\n", valveNo, fault);
-    nCombs = (2 << (set->nInputs - 1));
-    setValveFault(wiring, valveNo, fault);
-    time(&timeStarted);
-    for(i = 0; i < nCombs; i++) {
-        writeSerial(serial, set, wiring, i);
-        delay(delayMs);
-    }
-    listenForErrorsOn(net, timeStarted, fault == NONE ? -1 : valveNo);
+    injection->response = getFaultResponse(tester->sim, valveNo, fault);
+    if(injection->response != NULL) {
+        injection->nReports = tester->testSet != NULL ? 
+                countTestSetDetections(tester->sim, tester->testSet, injection->response) : 
+                injection->response->nDetectingVectors;
+        printf("%d vectors should report valve %d\n", injection->nReports, valveNo);
+        printFaultCandidates(tester->dict, valveNo, fault);
+    }
+    if(setValveFault(tester->wiring, valveNo, fault) < 0) {
+        return nFailed + 1;
+    }
+    // Reports arriving during the sweep are always within its listening time
+    injection->deadline.tv_sec = LONG_MAX;
+    injection->deadline.tv_nsec = 0;
+    tester->nOpen++;
+    lookahead = tester->confirmAfter > 0 && fault != NONE ? writer->ackWindow + CONFIRM_LOOKAHEAD : INT_MAX;
+    for(i = 0; i < nFrames || injection->nEmitted < nFrames; ) {
+        if(i < nFrames && i - injection->nEmitted < lookahead && queueSerialFrame(writer, sweep, i) == 0) {
+            i++;
+            continue;
+        }
+        readEmittedFrame(writer, &emitted, true);
+        if(injection->emitTimes != NULL) {
+            injection->emitTimes[emitted.frame] = emitted.emitted;
+        }
+        if(injection->nEmitted++ == 0) {
+            first = emitted;
+            injection->started = emitted.emitted;
+        }
+        latenessMs = getTimespecDiffMs(&emitted.emitted, &emitted.scheduled);
+        maxLatenessMs = latenessMs > maxLatenessMs ? latenessMs : maxLatenessMs;
+        if(emitted.acked) {
+            totalAckMs += getTimespecDiffMs(&emitted.acknowledged, &emitted.scheduled);
+            nAcked++;
+        }
+        if(lookahead < INT_MAX && nFrames == sweep->nFrames) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            nFailed += collectReports(tester, &now);
+            if(injection->nExpected >= tester->confirmAfter) {
+                // Only the vectors already queued are still emitted
+                nFrames = i;
+            }
+        }
+    }
+    if(nFrames < sweep->nFrames) {
+        printf("Detection confirmed after %d of %d vectors\n", nFrames, sweep->nFrames);
+        if(injection->response != NULL) {
+            injection->nReports = 0;
+            for(i = 0; i < nFrames; i++) {
+                injection->nReports += isDetectingVector(tester->sim, injection->response, 
+                        getSerialSweepVector(sweep, i));
+            }
+        }
+    }
+    // Reports for the last vectors may still be on their way
+    clock_gettime(CLOCK_MONOTONIC, &injection->deadline);
+    addTimespecNs(&injection->deadline, tester->listenMs * NS_PER_MS);
+    if(injection->nEmitted == 0) {
+        return nFailed;
+    }
+    printSweepTiming(&first, &emitted, maxLatenessMs, totalAckMs, nAcked, injection->nEmitted);
+    if(emitted.acked) {
+        hold = emitted.acknowledged;
+    } else {
+        hold = emitted.scheduled;
+        addTimespecNs(&hold, writer->periodNs);
+    }
+    return nFailed + collectReports(tester, &hold);
+}
+
+/*
+ * Tests nValves valves spread evenly through the wiring, or every valve if
+ * there are no more than that. Returns the number of fault injections that
+ * did not behave as expected
+ */
+int testSpreadFaults(FaultTester* tester, int nValves) {
+    struct timespec until;
+    int j, valveNo, nFailed = 0;
+    if(nValves <= 0 || nValves > tester->wiring->nValves) {
+        nValves = tester->wiring->nValves;
+    }
+    time(&tester->since);
+    setNetworkListening(tester->net, true);
+    for(j = 0; j < nValves; j++) {
+        valveNo = tester->wiring->valves[(long) j * tester->wiring->nValves / nValves]->number;
+        nFailed += testFaults(tester, valveNo, NONE);
+        nFailed += testFaults(tester, valveNo, SA0);
+        nFailed += testFaults(tester, valveNo, SA1);
+    }
+    if(tester->nOpen > 0) {
+        until = getOpenInjection(tester, tester->nOpen - 1)->deadline;
+        nFailed += collectReports(tester, &until);
+    }
+    setNetworkListening(tester->net, false);
+    return nFailed;
+}
+
+int testAllFaults(FaultTester* tester) {
+    return testSpreadFaults(tester, tester->wiring->nValves);
+}
+
+int isCycleDelayReliable(FaultTester* tester, int delayMs) {
+    int i;
+    printf("Calibrating with a cycle delay of %dms\n", delayMs);
+    setSerialWriterPeriod(tester->writer, delayMs);
+    for(i = 0; i < tester->calibrationRepeats; i++) {
+        if(testSpreadFaults(tester, tester->calibrationValves) > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Finds the shortest cycle delay at which every fault injection behaves as
+ * expected, doubling the delay until one does and then bisecting below it.
+ * No delay shorter than it takes to send a frame, or than 1ms, is tried
+ */
+int calibrateCycleDelay(FaultTester* tester, int delayMs) {
+    int minDelayMs = tester->minCycleDelayMs > 1 ? tester->minCycleDelayMs : 1;
+    int low, high, mid;
+    low = minDelayMs - 1;
+    high = delayMs > minDelayMs ? delayMs : minDelayMs;
+    while(!isCycleDelayReliable(tester, high)) {
+        if(high >= CALIBRATION_MAX_DELAY_MS) {
+            fprintf(stderr, "No cycle delay up to %dms was reliable\n", CALIBRATION_MAX_DELAY_MS);
+            return -1;
+        }
+        low = high;
+        high = high * 2 < CALIBRATION_MAX_DELAY_MS ? high * 2 : CALIBRATION_MAX_DELAY_MS;
+    }
+    while(high - low > 1) {
+        mid = (low + high) / 2;
+        if(isCycleDelayReliable(tester, mid)) {
+            high = mid;
+        } else {
+            low = mid;
+        }
+    }
+    return high;
+}
+
+int readCycleDelay(const char* filename) {
+    FILE* file = fopen(filename, "r");
+    int delayMs = -1;
+    if(file == NULL) {
+        return -1;
+    }
+    if(fscanf(file, "%d", &delayMs) != 1 || delayMs < 0) {
+        fprintf(stderr, "Could not read a cycle delay from %s\n", filename);
+        delayMs = -1;
+    }
+    fclose(file);
+    return delayMs;
+}
+
+int writeCycleDelay(const char* filename, int delayMs) {
+    FILE* file = fopen(filename, "w");
+    if(file == NULL) {
+        fprintf(stderr, "Could not save the cycle delay to %s\n", filename);
+        return -1;
+    }
+    fprintf(file, "%d\n", delayMs);
+    fclose(file);
+    return 0;
+}
+
+typedef struct {
+    const char* rxAddr;
+    const char* txAddr;
+    int txPort;
+    int baud;
+    const char* protocolName;
+    SerialProtocol protocol;
+    int ackWindow;
+    const char* gpioName;
+    GpioBackendType gpioType;
+    const char* gpioChip;
+    const char* delayFile;
+    int calibrate;
+    int calibrationRepeats;
+    int calibrationValves;
+    int listenMs;
+    int pipelineDepth;
+    int confirmAfter;
+    const char* latencyFile;
+    int echoOnly;
+    int useAtpg;
+    int grayCode;
+} TesterOptions;
+
+/*
+ * Frees whatever setupFaultTester got as far as setting up, in the reverse order
+ */
+void freeFaultTester(FaultTester* tester) {
+    int i;
+    if(tester->injections != NULL) {
+        for(i = 0; i < tester->depth; i++) {
+            free(tester->injections[i].emitTimes);
+            free(tester->injections[i].reported);
+            free(tester->injections[i].failingVectors);
+            freeMessageAggregator(tester->injections[i].aggregator);
+        }
+        free(tester->injections);
+    }
+    freeLatencyHistograms(tester->latencies);
+    freeSerialSweep(tester->sweep);
+    freeFaultDictionary(tester->dict);
+    freeTestSet(tester->testSet);
+    freeFaultSimulation(tester->sim);
+    if(tester->wiring != NULL) {
+        teardownWiring(tester->wiring);
+        freeWiring(tester->wiring);
+    }
+    freeGpioBackend(tester->gpio);
+    if(tester->net != NULL) {
+        teardownNetwork(tester->net);
+    }
+    freeSerialWriter(tester->writer);
+    if(tester->serial != NULL) {
+        teardownSerial(tester->serial);
+    }
+}
+
+/*
+ * Sets up the serial link, network, wiring and fault models of one rig. On
+ * failure returns -1 with what was set up left for freeFaultTester
+ */
+int setupFaultTester(FaultTester* tester, const TesterOptions* options, AssertionsSet* assertions, 
+        CircuitProgram* program, Rig* rig, int cycleDelay) {
+    int* dictVectors;
+    int i, nDictVectors;
+
+    memset(tester, 0, sizeof(FaultTester));
+    tester->serial = setupSerial(rig->deviceName, options->baud);
+    if(tester->serial == NULL) {
+        return -1;
+    }
+    printf("Cycle Delay: %dms\n", cycleDelay);
+    tester->writer = createSerialWriter(tester->serial, cycleDelay, options->ackWindow);
+    if(tester->writer == NULL) {
+        return -1;
+    }
+
+    if(options->echoOnly) {
+        tester->net = setupNetwork(options->rxAddr, rig->rxPort, NULL, 0);
+    } else {
+        tester->net = setupNetwork(options->rxAddr, rig->rxPort, options->txAddr, options->txPort);
+    }
+    if(tester->net == NULL) {
+        return -1;
+    }
+
+    parseWiringFile(rig->wiringFile, assertions, &tester->wiring);
+    if(tester->wiring == NULL) {
+        return -1;
+    }
+    tester->gpio = createGpioBackend(options->gpioType, options->gpioChip);
+    if(tester->gpio == NULL || setupWiring(tester->wiring, tester->gpio) < 0) {
+        return -1;
+    }
+    printf("GPIO: %s\n", options->gpioName);
+    
+    // Too many vectors to simulate every one, so a test set is picked from a sample
+    if(options->useAtpg && program->nInputs > MAX_TRUTH_TABLE_INPUTS) {
+        tester->sim = simulateSampledValveFaults(program, tester->wiring, FAULTSIM_SAMPLE_VECTORS);
+    } else {
+        tester->sim = simulateValveFaults(program, tester->wiring);
+    }
+    if(options->useAtpg) {
+        if(tester->sim == NULL) {
+            fprintf(stderr, "Cannot generate a test set without a fault simulation\n");
+            return -1;
+        }
+        tester->testSet = generateTestSet(tester->sim);
+    }
+    if(tester->testSet != NULL) {
+        tester->sweep = createSerialSweep(assertions, tester->wiring, tester->testSet->vectors, 
+                tester->testSet->nVectors, options->grayCode, options->protocol);
+    } else {
+        tester->sweep = createSerialSweep(assertions, tester->wiring, NULL, 0, options->grayCode, options->protocol);
+    }
+    if(tester->sweep == NULL) {
+        return -1;
+    }
+    if(tester->sim != NULL) {
+        nDictVectors = tester->testSet != NULL ? tester->testSet->nVectors : tester->sim->nVectors;
+        if(nDictVectors <= MAX_DICTIONARY_VECTORS) {
+            assert((dictVectors = malloc((nDictVectors + 1) * sizeof(int))) != NULL);
+            for(i = 0; i < nDictVectors; i++) {
+                dictVectors[i] = tester->testSet != NULL ? 
+                        tester->testSet->vectors[i] : getSimulatedVector(tester->sim, i);
+            }
+            tester->dict = createFaultDictionary(program, tester->sim, dictVectors, nDictVectors);
+            free(dictVectors);
+        } else {
+            printf("Too many vectors to build a fault dictionary, use --atpg to reduce them\n");
+        }
+    }
+
+    tester->listenMs = options->listenMs;
+    tester->confirmAfter = options->confirmAfter;
+    tester->minCycleDelayMs = getSerialFrameMs(tester->sweep, options->baud);
+    tester->calibrationRepeats = options->calibrationRepeats;
+    tester->calibrationValves = options->calibrationValves;
+    tester->latencies = createLatencyHistograms();
+    tester->depth = options->pipelineDepth;
+    assert((tester->injections = malloc(tester->depth * sizeof(Injection))) != NULL);
+    for(i = 0; i < tester->depth; i++) {
+        // Frames are only told apart against a fault simulation, so streamed
+        // sweeps of wide circuits keep nothing per frame
+        tester->injections[i].emitTimes = NULL;
+        tester->injections[i].reported = NULL;
+        if(tester->sim != NULL) {
+            assert((tester->injections[i].emitTimes = calloc(tester->sweep->nFrames + 1, sizeof(struct timespec))) != NULL);
+            assert((tester->injections[i].reported = calloc(tester->sweep->nFrames + 1, sizeof(uint8_t))) != NULL);
+        }
+        tester->injections[i].failingVectors = tester->dict != NULL ? createFailingVectors(tester->dict) : NULL;
+        tester->injections[i].aggregator = createMessageAggregator(AGGREGATION_WINDOW_MS);
+    }
+    tester->firstOpen = 0;
+    tester->nOpen = 0;
+    return 0;
+}
+
+/*
+ * Sets up one rig and tests every valve fault on it, or calibrates its cycle
+ * delay, recording the results in the rig. Only the circuit is shared with
+ * other rigs, and is not modified. Returns -1 if the rig could not be set up
+ */
+int runFaultTester(const TesterOptions* options, AssertionsSet* assertions, CircuitProgram* program, 
+        Rig* rig) {
+    FaultTester tester;
+    struct timespec started, finished;
+    int cycleDelay;
+    
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    printf("RX: %s:%d\nTX: %s:%d\nDevice: %s\nBaud: %d\nProtocol: %s\nEcho Only: %s\n",
+            options->rxAddr, rig->rxPort, options->txAddr, options->txPort, rig->deviceName, options->baud, 
+            options->protocolName, options->echoOnly ? "true" : "false");
+
+    cycleDelay = readCycleDelay(options->delayFile);
+    if(cycleDelay < 0) {
+        cycleDelay = CYCLE_DELAY_MS;
+    }
+    if(setupFaultTester(&tester, options, assertions, program, rig, cycleDelay) < 0) {
+        freeFaultTester(&tester);
+        return -1;
+    }
+
+    printTPs(assertions);
+    printProgramTruthTable(program, assertions);
+    printWiring(assertions, tester.wiring);
+    printValveWiring(tester.wiring);
+    printProgram(program);
+    if(tester.sim != NULL) {
+        printFaultSimulation(tester.sim);
+    }
+    if(tester.testSet != NULL) {
+        printTestSet(tester.testSet);
+    }
+    if(tester.dict != NULL) {
+        printFaultDictionary(tester.dict);
+    }
+
+    rig->result.nFailed = 0;
+    rig->result.nInjections = 0;
+    if(options->calibrate) {
+        cycleDelay = calibrateCycleDelay(&tester, cycleDelay);
+        if(cycleDelay >= 0) {
+            printf("Calibrated cycle delay: %dms\n", cycleDelay);
+            writeCycleDelay(options->delayFile, cycleDelay);
+        } else {
+            rig->result.nFailed = -1;
+        }
+    } else {
+        rig->result.nFailed = testAllFaults(&tester);
+        rig->result.nInjections = tester.wiring->nValves * N_INJECTIONS_PER_VALVE;
+    }
+    printLatencyHistograms(tester.latencies);
+    if(tester.latencies->n > 0) {
+        printf("Latencies run to when each report was read, up to %.1fms after it arrived\n", 
+                NETWORK_POLL_INTERVAL_US / 1000.0);
+    }
+    if(options->latencyFile[0] != '\0') {
+        writeLatencyHistograms(options->latencyFile, tester.latencies);
+    }
+
+    freeFaultTester(&tester);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    rig->result.elapsedS = getTimespecDiffMs(&finished, &started) / 1000.0;
+    return 0;
+}
+
+/*
+ * Runs in the child forked for a rig, with its output going to the rig's log
+ */
+int runCampaignRig(const TesterOptions* options, AssertionsSet* assertions, CircuitProgram* program, 
+        Rig* rig, int resultFd) {
+    if(freopen(rig->logFile, "w", stdout) == NULL) {
+        fprintf(stderr, "Could not open the log file \"%s\"\n", rig->logFile);
+        return EXIT_FAILURE;
+    }
+    dup2(fileno(stdout), STDERR_FILENO);
+    if(runFaultTester(options, assertions, program, rig) < 0) {
+        rig->result.nFailed = -1;
+    }
+    fflush(stdout);
+    if(write(resultFd, &rig->result, sizeof(RigResult)) != sizeof(RigResult)) {
+        fprintf(stderr, "Could not report the results of the rig\n");
+    }
+    close(resultFd);
+    return rig->result.nFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * Tests every rig of a campaign at once. The networking library has a single
+ * server per process, so rather than a thread each rig gets a forked child.
+ * They share the parsed circuit copy-on-write and send their results back
+ * through a pipe. Returns the number of rigs that did not pass
+ */
+int runRigCampaign(const TesterOptions* options, AssertionsSet* assertions, CircuitProgram* program, 
+        RigCampaign* campaign) {
+    Rig* rig;
+    int fds[2];
+    int i, status, nFailedRigs = 0;
+    for(i = 0; i < campaign->nRigs; i++) {
+        rig = campaign->rigs[i];
+        if(pipe(fds) < 0) {
+            fprintf(stderr, "Could not create a pipe for rig %d\n", i);
+            continue;
+        }
+        printf("Testing rig %d on %s, logging to %s\n", i, rig->deviceName, rig->logFile);
+        fflush(NULL);
+        rig->pid = fork();
+        if(rig->pid == 0) {
+            close(fds[0]);
+            exit(runCampaignRig(options, assertions, program, rig, fds[1]));
+        }
+        close(fds[1]);
+        if(rig->pid < 0) {
+            fprintf(stderr, "Could not start testing rig %d\n", i);
+            close(fds[0]);
+            continue;
+        }
+        rig->resultFd = fds[0];
+    }
+    for(i = 0; i < campaign->nRigs; i++) {
+        rig = campaign->rigs[i];
+        if(rig->pid > 0) {
+            // A rig that exits without reporting is left as aborted
+            if(read(rig->resultFd, &rig->result, sizeof(RigResult)) != sizeof(RigResult)) {
+                rig->result.nFailed = -1;
+            }
+            close(rig->resultFd);
+            waitpid(rig->pid, &status, 0);
+        }
+        if(rig->result.nFailed != 0) {
+            nFailedRigs++;
+        }
+    }
+    printRigResults(campaign);
+    return nFailedRigs;
 }
 
 typedef struct {
@@ -140,20 +913,36 @@ typedef struct {
 int main(int argc, char** argv) {
     LIBXML_TEST_VERSION
 
-    NetworkHandle* netHndl;
-    SerialHandle* serialHndl;
-    AssertionsSet* assertions;
-    Wiring* wiring;
+    AssertionsSet* assertions = NULL;
+    CircuitProgram* program = NULL;
+    RigCampaign* campaign;
+    Rig* rig;
+    TesterOptions options;
     char* programName;
     int maxOptionLen;
-    int i, j, k, valveNo;
+    int i, j, k;
     char* deviceName;
     char* rxAddr;
     int rxPort;
     char* txAddr;
     int txPort;
-    int echoOnly, readInOnly, helpMessage;
+    char* circuitLib;
+    char* protocolName;
+    SerialProtocol protocol;
+    char* gpioName;
+    char* gpioChip;
+    GpioBackendType gpioType;
+    int baud;
+    int ackWindow;
+    char* delayFile;
+    int listenMs;
+    int pipelineDepth;
+    int confirmAfter;
+    char* latencyFile;
+    char* campaignFile;
+    int echoOnly, readInOnly, helpMessage, useAtpg, grayCode, calibrate, calibrationRepeats, calibrationValves;
     int optionsParsingFailed = 0;
+    int status = EXIT_SUCCESS;
     
     programName = PROGRAM_NAME;
     if(argc > 0) {
@@ -171,9 +960,37 @@ int main(int argc, char** argv) {
     deviceName = malloc(sizeof(char) * (MAX_ARG_LEN + 1));
     assert(strlen(SERIAL_DEVICE) <= MAX_ARG_LEN);
     strcpy(deviceName, SERIAL_DEVICE);
+    circuitLib = malloc(sizeof(char) * (MAX_ARG_LEN + 1));
+    circuitLib[0] = '\0';
+    protocolName = malloc(sizeof(char) * (MAX_ARG_LEN + 1));
+    assert(strlen(SERIAL_PROTOCOL_ASCII_NAME) <= MAX_ARG_LEN);
+    strcpy(protocolName, SERIAL_PROTOCOL_ASCII_NAME);
+    gpioName = malloc(sizeof(char) * (MAX_ARG_LEN + 1));
+    assert(strlen(GPIO_BACKEND_DEFAULT_NAME) <= MAX_ARG_LEN);
+    strcpy(gpioName, GPIO_BACKEND_DEFAULT_NAME);
+    gpioChip = malloc(sizeof(char) * (MAX_ARG_LEN + 1));
+    assert(strlen(GPIO_CHIP_DEVICE) <= MAX_ARG_LEN);
+    strcpy(gpioChip, GPIO_CHIP_DEVICE);
+    baud = BAUD_RATE;
+    ackWindow = 0;
+    delayFile = malloc(sizeof(char) * (MAX_ARG_LEN + 1));
+    assert(strlen(CYCLE_DELAY_FILENAME) <= MAX_ARG_LEN);
+    strcpy(delayFile, CYCLE_DELAY_FILENAME);
+    calibrate = 0;
+    calibrationRepeats = CALIBRATION_REPEATS;
+    calibrationValves = 0;
+    listenMs = LISTEN_MS;
+    pipelineDepth = PIPELINE_DEPTH;
+    confirmAfter = 0;
+    latencyFile = malloc(sizeof(char) * (MAX_ARG_LEN + 1));
+    latencyFile[0] = '\0';
+    campaignFile = malloc(sizeof(char) * (MAX_ARG_LEN + 1));
+    campaignFile[0] = '\0';
     echoOnly = ECHO_ONLY;
     readInOnly = 0;
     helpMessage = 0;
+    useAtpg = 0;
+    grayCode = 0;
     
     CmdLineParam params[N_PARAMS] = {
         { .name="--rx-addr", .format="%s", .dest=rxAddr, .argsName="<address>", .description="The IP address on which to listen for error messages from the node being tested"},
@@ -181,9 +998,26 @@ int main(int argc, char** argv) {
         { .name="--tx-addr", .format="%s", .dest=txAddr, .argsName="<address>", .description="The IP address from which to send error messages to the mothership"},
         { .name="--tx-port", .format="%d", .dest=&txPort, .argsName="<port>", .description="The IP port from which to send error messages to the mothership"},
         { .name="--serial-device", .format="%s", .dest=deviceName, .argsName="<device>", .description="The serial device acting as the TPG"},
+        { .name="--baud", .format="%d", .dest=&baud, .argsName="<rate>", .description="The baud rate of the serial device"},
+        { .name="--protocol", .format="%s", .dest=protocolName, .argsName="<ascii|binary>", .description="Send vectors to the TPG as lines of ASCII digits or as packed binary frames"},
+        { .name="--ack-window", .format="%d", .dest=&ackWindow, .argsName="<n>", .description="Advance as the TPG acknowledges binary frames, with up to n in flight, rather than at a fixed rate"},
+        { .name="--gpio", .format="%s", .dest=gpioName, .argsName="<wiringpi|gpiochar|mock>", .description="How to drive the valve fault pins, mock leaving them untouched"},
+        { .name="--gpio-chip", .format="%s", .dest=gpioChip, .argsName="<device>", .description="The GPIO character device the valve pins are lines of, for gpiochar"},
+        { .name="--calibrate", .format=NULL, .dest=&calibrate, .argsName=NULL, .description="Find the shortest cycle delay at which every fault is still reported and save it"},
+        { .name="--calibration-repeats", .format="%d", .dest=&calibrationRepeats, .argsName="<n>", .description="How many times every fault must behave as expected for --calibrate to accept a cycle delay"},
+        { .name="--calibration-valves", .format="%d", .dest=&calibrationValves, .argsName="<n>", .description="Calibrate on n valves spread through the wiring rather than on every valve"},
+        { .name="--delay-file", .format="%s", .dest=delayFile, .argsName="<file>", .description="The file the calibrated cycle delay is saved to and read from"},
+        { .name="--listen-ms", .format="%d", .dest=&listenMs, .argsName="<ms>", .description="How long to wait for error messages after the last vector of each fault"},
+        { .name="--pipeline", .format="%d", .dest=&pipelineDepth, .argsName="<n>", .description="Keep collecting the error messages of up to n faults while the next are injected and swept"},
+        { .name="--confirm-after", .format="%d", .dest=&confirmAfter, .argsName="<n>", .description="Move on to the next fault once n error messages have confirmed it is detected, rather than sweeping every vector"},
+        { .name="--latency-file", .format="%s", .dest=latencyFile, .argsName="<file>", .description="Write histograms of how long the node took to report each fault to a file"},
         { .name="--no-up-network", .format=NULL, .dest=&echoOnly, .argsName=NULL, .description="Do not relay any error messages to the mothership and simply echo them"},
         { .name="--help", .format=NULL, .dest=&helpMessage, .argsName=NULL, .description="Display this help message"},
-        { .name="--read-config", .format=NULL, .dest=&readInOnly, .argsName=NULL, .description="Echo the parsed contents of the configuration files"}
+        { .name="--read-config", .format=NULL, .dest=&readInOnly, .argsName=NULL, .description="Echo the parsed contents of the configuration files"},
+        { .name="--circuit-lib", .format="%s", .dest=circuitLib, .argsName="<file>", .description="A shared object generated by circuitgen to evaluate the circuit with"},
+        { .name="--atpg", .format=NULL, .dest=&useAtpg, .argsName=NULL, .description="Only drive a generated set of vectors that detects every detectable valve fault, picked from a sample of vectors when there are too many to simulate"},
+        { .name="--campaign", .format="%s", .dest=campaignFile, .argsName="<file>", .description="Test every rig listed in a file at once, one per line as \"<serial device> <rx port> <wiring file> [log file]\""},
+        { .name="--gray-code", .format=NULL, .dest=&grayCode, .argsName=NULL, .description="Order the vectors so that as few input pins as possible change between them"}
     };
     
     for(i = 1; i < argc && !optionsParsingFailed; i++) {
@@ -219,6 +1053,36 @@ int main(int argc, char** argv) {
             break;
         }
     }
+    if(!optionsParsingFailed && getSerialProtocolByName(protocolName, &protocol) < 0) {
+        optionsParsingFailed = 1;
+    }
+    if(!optionsParsingFailed && getGpioBackendByName(gpioName, &gpioType) < 0) {
+        optionsParsingFailed = 1;
+    }
+    if(!optionsParsingFailed && ackWindow > 0 && calibrate) {
+        fprintf(stderr, "There is no cycle delay to calibrate when frames are acknowledged\n");
+        optionsParsingFailed = 1;
+    }
+    if(!optionsParsingFailed && (calibrationRepeats < 1 || calibrationValves < 0)) {
+        fprintf(stderr, "Calibration needs at least one repeat and cannot use a negative number of valves\n");
+        optionsParsingFailed = 1;
+    }
+    if(!optionsParsingFailed && ackWindow > 0 && protocol != SERIAL_PROTOCOL_BINARY) {
+        fprintf(stderr, "Acknowledged frames need the %s protocol\n", SERIAL_PROTOCOL_BINARY_NAME);
+        optionsParsingFailed = 1;
+    }
+    if(!optionsParsingFailed && pipelineDepth < 1) {
+        fprintf(stderr, "The pipeline must hold at least one fault\n");
+        optionsParsingFailed = 1;
+    }
+    if(!optionsParsingFailed && confirmAfter < 0) {
+        fprintf(stderr, "The number of error messages confirming a fault cannot be negative\n");
+        optionsParsingFailed = 1;
+    }
+    if(!optionsParsingFailed && campaignFile[0] != '\0' && (calibrate || latencyFile[0] != '\0')) {
+        fprintf(stderr, "Calibrate rigs and record their latencies one at a time rather than in a campaign\n");
+        optionsParsingFailed = 1;
+    }
     if(optionsParsingFailed) {
         printf("Try \"%s --help\" for help on using this program\n", programName);
         return -1;
@@ -250,49 +1114,67 @@ int main(int argc, char** argv) {
         }
         free(optionStrings);
     } else {
-        printf("RX: %s:%d\nTX: %s:%d\nDevice: %s\nEcho Only: %s\n",
-                rxAddr, rxPort, txAddr, txPort, deviceName, echoOnly ? "true" : "false");
+        options.rxAddr = rxAddr;
+        options.txAddr = txAddr;
+        options.txPort = txPort;
+        options.baud = baud;
+        options.protocolName = protocolName;
+        options.protocol = protocol;
+        options.ackWindow = ackWindow;
+        options.gpioName = gpioName;
+        options.gpioType = gpioType;
+        options.gpioChip = gpioChip;
+        options.delayFile = delayFile;
+        options.calibrate = calibrate;
+        options.calibrationRepeats = calibrationRepeats;
+        options.calibrationValves = calibrationValves;
+        options.listenMs = listenMs;
+        options.pipelineDepth = pipelineDepth;
+        options.confirmAfter = confirmAfter;
+        options.latencyFile = latencyFile;
+        options.echoOnly = echoOnly;
+        options.useAtpg = useAtpg;
+        options.grayCode = grayCode;
 
-        serialHndl = setupSerial(deviceName, BAUD_RATE) ;
-        if(serialHndl == NULL) {
+        parseCircuitFile(CIRCUIT_FILNAME, &assertions, &program);
+        assert(assertions != NULL);
+        if(program == NULL) {
+            freeAssertionSet(assertions);
             return -1;
         }
-
-        if(echoOnly) {
-            netHndl = setupNetwork(rxAddr, rxPort, txAddr, txPort);
-        } else {
-            netHndl = setupNetwork(rxAddr, rxPort, NULL, 0);
-        }
-        if(netHndl == NULL) {
+        if(circuitLib[0] != '\0' && loadCompiledCircuit(program, circuitLib) < 0) {
             return -1;
         }
 
-        setupWiring();
-
-        get(&assertions, &wiring);
-
-        free(rxAddr);
-        free(txAddr);
-        free(deviceName);
-
-        printTPs(assertions);
-        printTruthTable(assertions);
-        printWiring(assertions, wiring);
-        printValveWiring(wiring);
-
-        for(j = 0; j < wiring->nValves; j++) {
-            valveNo = wiring->valves[j]->number;
-            testFaults(assertions, wiring, serialHndl, netHndl, valveNo, NONE, CYCLE_DELAY_MS);
-            testFaults(assertions, wiring, serialHndl, netHndl, valveNo, SA0, CYCLE_DELAY_MS);
-            testFaults(assertions, wiring, serialHndl, netHndl, valveNo, SA1, CYCLE_DELAY_MS);
+        if(campaignFile[0] != '\0') {
+            campaign = readRigCampaign(campaignFile);
+            if(campaign == NULL) {
+                return -1;
+            }
+            if(runRigCampaign(&options, assertions, program, campaign) > 0) {
+                status = EXIT_FAILURE;
+            }
+            freeRigCampaign(campaign);
+        } else {
+            rig = createRig(deviceName, rxPort, WIRING_FILNAME, NULL);
+            if(runFaultTester(&options, assertions, program, rig) < 0 || rig->result.nFailed != 0) {
+                status = EXIT_FAILURE;
+            }
+            freeRig(rig);
         }
 
+        freeCircuitProgram(program);
         freeAssertionSet(assertions);
-        freeWiring(wiring);
-        teardownWiring();
-        teardownNetwork(netHndl);
-        teardownSerial(serialHndl);
     }
-    return (EXIT_SUCCESS);
+    free(rxAddr);
+    free(txAddr);
+    free(deviceName);
+    free(circuitLib);
+    free(protocolName);
+    free(gpioName);
+    free(gpioChip);
+    free(delayFile);
+    free(latencyFile);
+    free(campaignFile);
+    return status;
 }
-
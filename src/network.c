@@ -1,14 +1,132 @@
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include "network.h"
 #include "edsac_representation.h"
 #include "edsac_sending.h"
 #include "edsac_server.h"
 #include "edsac_arguments.h"
 
+/*
+ * Received messages are freed with free_message, which frees the buffer item
+ * the message was received in as the message is its first member
+ */
+_Static_assert(offsetof(BufferItem, msg) == 0, "BufferItem must start with its Message");
+
+void freeBufferItem(BufferItem* item) {
+    free_message(&item->msg);
+}
+
+/*
+ * The poll interval doubles while nothing arrives, up to
+ * NETWORK_POLL_MAX_INTERVAL_US, so an idle pump rarely wakes. Messages are
+ * timestamped as they are read, so while listening for reports the interval
+ * stays at NETWORK_POLL_INTERVAL_US to keep those timestamps close
+ */
+void* pumpNetworkMessages(void* arg) {
+    NetworkHandle* network = arg;
+    NetworkQueueItem* queued;
+    BufferItem* buff;
+    uint64_t one = 1;
+    int intervalUs = NETWORK_POLL_INTERVAL_US;
+    while(__atomic_load_n(&network->pumping, __ATOMIC_ACQUIRE)) {
+        buff = read_message();
+        if(buff == NULL) {
+            usleep(intervalUs);
+            if(__atomic_load_n(&network->listening, __ATOMIC_RELAXED)) {
+                intervalUs = NETWORK_POLL_INTERVAL_US;
+            } else {
+                intervalUs = intervalUs * 2 < NETWORK_POLL_MAX_INTERVAL_US ? intervalUs * 2 : NETWORK_POLL_MAX_INTERVAL_US;
+            }
+            continue;
+        }
+        intervalUs = NETWORK_POLL_INTERVAL_US;
+        assert((queued = malloc(sizeof(NetworkQueueItem))) != NULL);
+        queued->item = buff;
+        clock_gettime(CLOCK_MONOTONIC, &queued->received);
+        queued->next = NULL;
+        pthread_mutex_lock(&network->queueLock);
+        if(network->queueTail != NULL) {
+            network->queueTail->next = queued;
+        } else {
+            network->queueHead = queued;
+        }
+        network->queueTail = queued;
+        pthread_mutex_unlock(&network->queueLock);
+        while(write(network->eventFd, &one, sizeof(one)) < 0 && errno == EINTR);
+    }
+    return NULL;
+}
+
+int startNetworkPump(NetworkHandle* network) {
+    struct epoll_event event;
+    network->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    network->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    network->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if(network->eventFd < 0 || network->timerFd < 0 || network->epollFd < 0) {
+        return -1;
+    }
+    event.events = EPOLLIN;
+    event.data.fd = network->eventFd;
+    if(epoll_ctl(network->epollFd, EPOLL_CTL_ADD, network->eventFd, &event) < 0) {
+        return -1;
+    }
+    event.data.fd = network->timerFd;
+    if(epoll_ctl(network->epollFd, EPOLL_CTL_ADD, network->timerFd, &event) < 0) {
+        return -1;
+    }
+    network->pumping = true;
+    if(pthread_create(&network->pump, NULL, pumpNetworkMessages, network) != 0) {
+        network->pumping = false;
+        return -1;
+    }
+    return 0;
+}
+
+void* relayNetworkMessages(void* arg) {
+    NetworkHandle* network = arg;
+    Message* batch[RELAY_BATCH_SIZE];
+    int owned[RELAY_BATCH_SIZE];
+    int i, n, nFailed;
+    pthread_mutex_lock(&network->relayLock);
+    while(network->relaying || network->relayCount > 0) {
+        if(network->relayCount == 0) {
+            pthread_cond_wait(&network->relayReady, &network->relayLock);
+            continue;
+        }
+        for(n = 0; n < RELAY_BATCH_SIZE && network->relayCount > 0; n++) {
+            batch[n] = network->relayQueue[network->relayHead];
+            owned[n] = network->relayQueueOwned[network->relayHead];
+            network->relayHead = (network->relayHead + 1) % RELAY_QUEUE_SIZE;
+            network->relayCount--;
+        }
+        pthread_mutex_unlock(&network->relayLock);
+        nFailed = 0;
+        for(i = 0; i < n; i++) {
+            if(!send_message(batch[i])) {
+                nFailed++;
+            }
+            if(owned[i]) {
+                free_message(batch[i]);
+            }
+        }
+        pthread_mutex_lock(&network->relayLock);
+        network->nRelayed += n - nFailed;
+        network->nRelayFailed += nFailed;
+    }
+    pthread_mutex_unlock(&network->relayLock);
+    return NULL;
+}
+
 NetworkHandle* setupNetwork(const char* rxAddrStr, int rxPort, 
         const char* txAddrStr, int txPort) {
     
@@ -17,6 +135,22 @@ NetworkHandle* setupNetwork(const char* rxAddrStr, int rxPort,
     NetworkHandle* network = malloc(sizeof(NetworkHandle));
     network->sending = false;
     network->server = false;
+    network->pumping = false;
+    network->listening = false;
+    pthread_mutex_init(&network->queueLock, NULL);
+    network->queueHead = NULL;
+    network->queueTail = NULL;
+    network->eventFd = -1;
+    network->timerFd = -1;
+    network->epollFd = -1;
+    network->relaying = false;
+    pthread_mutex_init(&network->relayLock, NULL);
+    pthread_cond_init(&network->relayReady, NULL);
+    network->relayHead = 0;
+    network->relayCount = 0;
+    network->nRelayed = 0;
+    network->nRelayDropped = 0;
+    network->nRelayFailed = 0;
     if(txAddrStr != NULL) {
         adr = alloc_addr(txAddrStr, txPort);
         assert(NULL != adr);
@@ -27,6 +161,13 @@ NetworkHandle* setupNetwork(const char* rxAddrStr, int rxPort,
             teardownNetwork(network);
             return NULL;
         }
+        network->relaying = true;
+        if(pthread_create(&network->relay, NULL, relayNetworkMessages, network) != 0) {
+            network->relaying = false;
+            fprintf(stderr, "Could not start relaying\n");
+            teardownNetwork(network);
+            return NULL;
+        }
     }
     if(rxAddrStr != NULL) {
         adr = alloc_addr(rxAddrStr, rxPort);
@@ -38,22 +179,86 @@ NetworkHandle* setupNetwork(const char* rxAddrStr, int rxPort,
             teardownNetwork(network);
             return NULL;
         }
+        if(startNetworkPump(network) < 0) {
+            fprintf(stderr, "Could not start receiving messages\n");
+            teardownNetwork(network);
+            return NULL;
+        }
     }
     return network;
 }
 
-Message* readNetworkMessage(NetworkHandle* network, time_t since) {
-    BufferItem* buff;
+void setNetworkListening(NetworkHandle* network, int listening) {
+    __atomic_store_n(&network->listening, listening, __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns the next queued message received no earlier than since, without
+ * waiting. Older messages are discarded. If given, received is set to the
+ * CLOCK_MONOTONIC time the message was taken from the server. The caller
+ * frees the message with free_message
+ */
+Message* readNetworkMessage(NetworkHandle* network, time_t since, struct timespec* received) {
+    NetworkQueueItem* queued;
     Message* msg = NULL;
     assert(network != NULL);
     if(!network->server) {
         fprintf(stderr, "Server has not been started\n");
         return NULL;
     }
-    buff = read_message();
-    if(buff != NULL) {
-        if(difftime(since, buff->recv_time)) {
-            msg = &buff->msg;
+    pthread_mutex_lock(&network->queueLock);
+    while(msg == NULL && (queued = network->queueHead) != NULL) {
+        network->queueHead = queued->next;
+        if(network->queueHead == NULL) {
+            network->queueTail = NULL;
+        }
+        if(difftime(queued->item->recv_time, since) >= 0) {
+            msg = &queued->item->msg;
+            if(received != NULL) {
+                *received = queued->received;
+            }
+        } else {
+            freeBufferItem(queued->item);
+        }
+        free(queued);
+    }
+    pthread_mutex_unlock(&network->queueLock);
+    return msg;
+}
+
+/*
+ * As readNetworkMessage, but sleeps until a message arrives or the
+ * CLOCK_MONOTONIC deadline passes, returning NULL for the latter
+ */
+Message* waitForNetworkMessage(NetworkHandle* network, time_t since, const struct timespec* deadline, 
+        struct timespec* received) {
+    struct itimerspec timer;
+    struct epoll_event events[2];
+    Message* msg;
+    uint64_t n;
+    int i, nEvents, expired = false;
+    assert(network != NULL);
+    if(!network->server) {
+        fprintf(stderr, "Server has not been started\n");
+        return NULL;
+    }
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value = *deadline;
+    if(timer.it_value.tv_sec == 0 && timer.it_value.tv_nsec == 0) {
+        // A zero it_value would disarm the timer rather than expire at once
+        timer.it_value.tv_nsec = 1;
+    }
+    if(timerfd_settime(network->timerFd, TFD_TIMER_ABSTIME, &timer, NULL) < 0) {
+        fprintf(stderr, "Could not set the network deadline\n");
+        return readNetworkMessage(network, since, received);
+    }
+    while((msg = readNetworkMessage(network, since, received)) == NULL && !expired) {
+        nEvents = epoll_wait(network->epollFd, events, 2, -1);
+        for(i = 0; i < nEvents; i++) {
+            if(events[i].data.fd == network->timerFd) {
+                expired = true;
+            }
+            while(read(events[i].data.fd, &n, sizeof(n)) < 0 && errno == EINTR);
         }
     }
     return msg;
@@ -75,13 +280,77 @@ int resendNetworkMessage(NetworkHandle* network, const Message* msg) {
     return 1;
 }
 
+/*
+ * Queues a message for the sender thread without waiting, returning -1 and
+ * counting it as dropped if the queue is full. Owned messages are freed
+ * once sent or dropped
+ */
+int relayNetworkMessage(NetworkHandle* network, Message* msg, int owned) {
+    int queued = false;
+    assert(network != NULL);
+    if(!network->relaying) {
+        fprintf(stderr, "Sending has not been started\n");
+        if(owned) {
+            free_message(msg);
+        }
+        return -1;
+    }
+    pthread_mutex_lock(&network->relayLock);
+    if(network->relayCount < RELAY_QUEUE_SIZE) {
+        network->relayQueue[(network->relayHead + network->relayCount) % RELAY_QUEUE_SIZE] = msg;
+        network->relayQueueOwned[(network->relayHead + network->relayCount) % RELAY_QUEUE_SIZE] = owned;
+        network->relayCount++;
+        queued = true;
+        pthread_cond_signal(&network->relayReady);
+    } else {
+        network->nRelayDropped++;
+    }
+    pthread_mutex_unlock(&network->relayLock);
+    if(!queued && owned) {
+        free_message(msg);
+    }
+    return queued ? 1 : -1;
+}
+
+void printRelayStatistics(NetworkHandle* network) {
+    pthread_mutex_lock(&network->relayLock);
+    printf("Relayed %d messages, %d dropped as the queue was full, %d failed to send\n", 
+            network->nRelayed, network->nRelayDropped, network->nRelayFailed);
+    pthread_mutex_unlock(&network->relayLock);
+}
+
 void teardownNetwork(NetworkHandle* network) {
+    if(network->relaying) {
+        // Flushes whatever is still queued before stopping
+        pthread_mutex_lock(&network->relayLock);
+        network->relaying = false;
+        pthread_cond_signal(&network->relayReady);
+        pthread_mutex_unlock(&network->relayLock);
+        pthread_join(network->relay, NULL);
+        printRelayStatistics(network);
+    }
     if(network->sending) {
         stop_sending();
     }
+    if(network->pumping) {
+        __atomic_store_n(&network->pumping, false, __ATOMIC_RELEASE);
+        pthread_join(network->pump, NULL);
+    }
     if(network->server) {
         stop_server();
     }
+    while(network->queueHead != NULL) {
+        network->queueTail = network->queueHead->next;
+        freeBufferItem(network->queueHead->item);
+        free(network->queueHead);
+        network->queueHead = network->queueTail;
+    }
+    pthread_mutex_destroy(&network->queueLock);
+    pthread_mutex_destroy(&network->relayLock);
+    pthread_cond_destroy(&network->relayReady);
+    close(network->eventFd);
+    close(network->timerFd);
+    close(network->epollFd);
     free(network);
 }
 
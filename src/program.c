@@ -0,0 +1,548 @@
+#include <assert.h>
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libxml/tree.h>
+#include <libxml/xmlstring.h>
+#include "assertions.h"
+#include "hashindex.h"
+#include "program.h"
+#include "tables.h"
+#include "xmlutil.h"
+
+#define NODE_NAME_TP "tp"
+#define NODE_NAME_REF "ref"
+#define NODE_NAME_AND "and"
+#define NODE_NAME_OR "or"
+#define NODE_NAME_NOT "not"
+#define ATTR_NAME_ID "id"
+#define ATTR_NAME_VALVE_NO "valve_no"
+
+#define TRUTH_WORD_SHIFT 6
+
+#define REGISTER_UNCOMPILED -1
+#define REGISTER_COMPILING -2
+
+#define TABLE_TITLE "Circuit Program"
+#define TABLE_INSTRUCTIONS_HEADING "Instructions"
+#define TABLE_LEVELS_HEADING "Levels"
+#define TABLE_REGISTERS_HEADING "Registers"
+#define TABLE_VECTORS_HEADING "Vectors/Pass"
+#define TRUTH_TABLE_TITLE "Truth Table"
+#define TRUTH_TABLE_TOO_WIDE_MESSAGE "Truth table not shown: %d inputs are too many to list\n"
+
+typedef struct {
+    CircuitProgram* program;
+    AssertionsSet* set;
+    xmlNode** nodes;
+    int* nodeRegisters;
+    int nNodes;
+    HashIndex* idIndices;
+    int* levels;
+    int instructionsCapacity;
+} ProgramCompiler;
+
+int emitInstruction(ProgramCompiler* compiler, InstructionOp op, int a, int b, int valveNo) {
+    CircuitProgram* program = compiler->program;
+    Instruction* instr;
+    int dst = program->nRegisters++;
+    if(program->nInstructions >= compiler->instructionsCapacity) {
+        compiler->instructionsCapacity = compiler->instructionsCapacity * 2 + 16;
+        program->instructions = realloc(program->instructions, 
+                compiler->instructionsCapacity * sizeof(Instruction));
+        compiler->levels = realloc(compiler->levels, 
+                (program->nInputs + compiler->instructionsCapacity) * sizeof(int));
+    }
+    instr = &program->instructions[program->nInstructions++];
+    instr->op = op;
+    instr->dst = dst;
+    instr->a = a;
+    instr->b = b;
+    instr->valveNo = valveNo;
+    compiler->levels[dst] = 1 + (compiler->levels[a] > compiler->levels[b] ? 
+        compiler->levels[a] : compiler->levels[b]);
+    return dst;
+}
+
+int compileNode(ProgramCompiler* compiler, xmlNode* node);
+
+int compileNamedNode(ProgramCompiler* compiler, int index) {
+    int reg = compiler->nodeRegisters[index];
+    xmlChar* id;
+    if(reg == REGISTER_COMPILING) {
+        id = xmlGetProp(compiler->nodes[index], ATTR_NAME_ID);
+        fprintf(stderr, "Node \"%s\" refers to itself\n", id);
+        xmlFree(id);
+        return -1;
+    }
+    if(reg == REGISTER_UNCOMPILED) {
+        compiler->nodeRegisters[index] = REGISTER_COMPILING;
+        reg = compileNode(compiler, compiler->nodes[index]);
+        compiler->nodeRegisters[index] = reg < 0 ? REGISTER_UNCOMPILED : reg;
+    }
+    return reg;
+}
+
+int compileOperator(ProgramCompiler* compiler, xmlNode* node, InstructionOp op) {
+    xmlNode* child;
+    int nOperands = 0, i, reg, valveNo;
+    int* operands = NULL;
+    if(!xmlHasProp(node, ATTR_NAME_VALVE_NO)) {
+        fprintf(stderr, "%s node has no valveNo\n", node->name);
+        return -1;
+    }
+    valveNo = nodePropAsInteger(node, ATTR_NAME_VALVE_NO);
+    for(child = node->children; child != NULL; child = child->next) {
+        if(child->type == XML_ELEMENT_NODE) {
+            reg = compileNode(compiler, child);
+            if(reg < 0) {
+                free(operands);
+                return -1;
+            }
+            operands = realloc(operands, (nOperands + 1) * sizeof(int));
+            operands[nOperands++] = reg;
+        }
+    }
+    if(nOperands == 0) {
+        fprintf(stderr, "Operator node has no params\n");
+        return -1;
+    }
+    if(op == INSTR_NOT && nOperands > 1) {
+        fprintf(stderr, "Not operator can only have one param\n");
+        free(operands);
+        return -1;
+    }
+    // Only the instruction producing the operator's output carries its valve,
+    // so faults are injected where the valve actually sits
+    if(op == INSTR_NOT || nOperands == 1) {
+        reg = emitInstruction(compiler, op, operands[0], operands[0], valveNo);
+    } else {
+        reg = operands[0];
+        for(i = 1; i < nOperands; i++) {
+            reg = emitInstruction(compiler, op, reg, operands[i], 
+                    i == nOperands - 1 ? valveNo : -1);
+        }
+    }
+    free(operands);
+    return reg;
+}
+
+int compileNode(ProgramCompiler* compiler, xmlNode* node) {
+    xmlNode* child;
+    xmlChar* contents;
+    int index;
+    if(strEqual(node->name, NODE_NAME_REF)) {
+        contents = xmlNodeListGetString(node->doc, node->children, 1);
+        index = hashIndexGetStr(compiler->idIndices, contents);
+        if(index < 0) {
+            fprintf(stderr, "No such node id found \"%s\"\n", contents);
+            xmlFree(contents);
+            return -1;
+        }
+        xmlFree(contents);
+        return compileNamedNode(compiler, index);
+    } else if(strEqual(node->name, NODE_NAME_AND)) {
+        return compileOperator(compiler, node, INSTR_AND);
+    } else if(strEqual(node->name, NODE_NAME_OR)) {
+        return compileOperator(compiler, node, INSTR_OR);
+    } else if(strEqual(node->name, NODE_NAME_NOT)) {
+        return compileOperator(compiler, node, INSTR_NOT);
+    } else if(strEqual(node->name, NODE_NAME_TP)) {
+        for(child = node->children; child != NULL; child = child->next) {
+            if(child->type == XML_ELEMENT_NODE) {
+                return compileNode(compiler, child);
+            }
+        }
+        // Input registers are numbered by the input's index in the set, so
+        // bit i of a vector number drives register i
+        index = getIndexOfTPNodeInSet(compiler->set, node);
+        if(index < 0 || index >= compiler->set->nInputs) {
+            fprintf(stderr, "TP has no child nodes but isn't an indexed input\n");
+            return -1;
+        }
+        return index;
+    }
+    fprintf(stderr, "Unknown node type \"%s\"\n", node->name);
+    return -1;
+}
+
+void leveliseProgram(ProgramCompiler* compiler) {
+    CircuitProgram* program = compiler->program;
+    Instruction* sorted;
+    int* counts;
+    int i, level;
+    
+    program->nLevels = 0;
+    for(i = 0; i < program->nInstructions; i++) {
+        level = compiler->levels[program->instructions[i].dst];
+        if(level > program->nLevels) {
+            program->nLevels = level;
+        }
+    }
+    assert((counts = calloc(program->nLevels + 1, sizeof(int))) != NULL);
+    for(i = 0; i < program->nInstructions; i++) {
+        counts[compiler->levels[program->instructions[i].dst] - 1]++;
+    }
+    assert((program->levelStarts = malloc((program->nLevels + 1) * sizeof(int))) != NULL);
+    program->levelStarts[0] = 0;
+    for(i = 0; i < program->nLevels; i++) {
+        program->levelStarts[i + 1] = program->levelStarts[i] + counts[i];
+        counts[i] = program->levelStarts[i];
+    }
+    assert((sorted = malloc((program->nInstructions + 1) * sizeof(Instruction))) != NULL);
+    for(i = 0; i < program->nInstructions; i++) {
+        level = compiler->levels[program->instructions[i].dst] - 1;
+        sorted[counts[level]++] = program->instructions[i];
+    }
+    free(program->instructions);
+    program->instructions = sorted;
+    free(counts);
+}
+
+CircuitProgram* compileCircuitProgram(xmlNode* circuitNode, AssertionsSet* set) {
+    ProgramCompiler compiler;
+    CircuitProgram* program;
+    xmlNode* child;
+    xmlChar* id;
+    int i, index, failed = 0;
+    assert(set != NULL);
+    if(set->nInputs > PROGRAM_MAX_INPUTS) {
+        fprintf(stderr, "Circuit has %d inputs, more than the %d its vectors can be numbered with\n", 
+                set->nInputs, PROGRAM_MAX_INPUTS);
+        return NULL;
+    }
+    
+    program = malloc(sizeof(CircuitProgram));
+    program->instructions = NULL;
+    program->nInstructions = 0;
+    program->levelStarts = NULL;
+    program->nLevels = 0;
+    program->nInputs = set->nInputs;
+    program->nRegisters = set->nInputs;
+    program->nTps = set->nTp;
+    program->compiledLibrary = NULL;
+    program->compiled = NULL;
+    assert((program->tpRegisters = malloc(set->nTp * sizeof(int))) != NULL);
+    
+    compiler.program = program;
+    compiler.set = set;
+    compiler.nodes = NULL;
+    compiler.nodeRegisters = NULL;
+    compiler.nNodes = 0;
+    compiler.idIndices = createHashIndex(0);
+    assert((compiler.levels = calloc(set->nInputs + 1, sizeof(int))) != NULL);
+    compiler.instructionsCapacity = 0;
+    for(child = circuitNode->children; child != NULL; child = child->next) {
+        if(child->type == XML_ELEMENT_NODE && xmlHasProp(child, ATTR_NAME_ID)) {
+            id = xmlGetProp(child, ATTR_NAME_ID);
+            hashIndexPutStr(compiler.idIndices, id, compiler.nNodes);
+            xmlFree(id);
+            compiler.nodes = realloc(compiler.nodes, (compiler.nNodes + 1) * sizeof(xmlNode*));
+            compiler.nodes[compiler.nNodes] = child;
+            compiler.nodeRegisters = realloc(compiler.nodeRegisters, (compiler.nNodes + 1) * sizeof(int));
+            compiler.nodeRegisters[compiler.nNodes] = REGISTER_UNCOMPILED;
+            compiler.nNodes++;
+        }
+    }
+    
+    for(i = 0; i < set->nTp && !failed; i++) {
+        index = hashIndexGetStr(compiler.idIndices, set->tps[i]->tpName);
+        if(index < 0) {
+            fprintf(stderr, "TP \"%s\" is not in the circuit\n", set->tps[i]->tpName);
+            failed = 1;
+            break;
+        }
+        program->tpRegisters[i] = compileNamedNode(&compiler, index);
+        failed = program->tpRegisters[i] < 0;
+    }
+    if(!failed) {
+        leveliseProgram(&compiler);
+    }
+    
+    free(compiler.nodes);
+    free(compiler.nodeRegisters);
+    free(compiler.levels);
+    freeHashIndex(compiler.idIndices);
+    if(failed) {
+        freeCircuitProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+void freeCircuitProgram(CircuitProgram* program) {
+    if(program != NULL) {
+        if(program->compiledLibrary != NULL) {
+            dlclose(program->compiledLibrary);
+        }
+        free(program->instructions);
+        free(program->levelStarts);
+        free(program->tpRegisters);
+        free(program);
+    }
+}
+
+unsigned int getCircuitProgramHash(CircuitProgram* program) {
+    unsigned int hash[3];
+    hash[0] = getHashOfBytes(program->instructions, program->nInstructions * sizeof(Instruction));
+    hash[1] = getHashOfBytes(program->tpRegisters, program->nTps * sizeof(int));
+    hash[2] = program->nInputs;
+    return getHashOfBytes(hash, sizeof(hash));
+}
+
+/*
+ * Replaces the interpreter with an evaluator generated by circuitgen. The
+ * library must have been generated from the same circuit, which is checked
+ * against the program hash it was built with
+ */
+int loadCompiledCircuit(CircuitProgram* program, const char* path) {
+    void* library;
+    unsigned int* hash;
+    CompiledCircuitFunction compiled;
+    library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if(library == NULL) {
+        fprintf(stderr, "Could not load compiled circuit \"%s\": %s\n", path, dlerror());
+        return -1;
+    }
+    hash = dlsym(library, COMPILED_CIRCUIT_HASH);
+    compiled = (CompiledCircuitFunction) dlsym(library, COMPILED_CIRCUIT_FUNCTION);
+    if(hash == NULL || compiled == NULL) {
+        fprintf(stderr, "\"%s\" is not a compiled circuit\n", path);
+        dlclose(library);
+        return -1;
+    }
+    if(*hash != getCircuitProgramHash(program)) {
+        fprintf(stderr, "\"%s\" was compiled from a different circuit\n", path);
+        dlclose(library);
+        return -1;
+    }
+    if(program->compiledLibrary != NULL) {
+        dlclose(program->compiledLibrary);
+    }
+    program->compiledLibrary = library;
+    program->compiled = compiled;
+    return 0;
+}
+
+TruthWord* createProgramRegisters(CircuitProgram* program) {
+    TruthWord* registers;
+    assert((registers = calloc(program->nRegisters * PROGRAM_BLOCK_WORDS, sizeof(TruthWord))) != NULL);
+    return registers;
+}
+
+void setProgramInputsForVectors(CircuitProgram* program, TruthWord* registers, uint64_t firstVector) {
+    int i, j, w;
+    uint64_t base;
+    TruthWord pattern;
+    assert(firstVector % TRUTH_WORD_BITS == 0);
+    for(i = 0; i < program->nInputs; i++) {
+        if(i < TRUTH_WORD_SHIFT) {
+            // Low inputs alternate within a word, identically in every word
+            pattern = 0;
+            for(j = 0; j < TRUTH_WORD_BITS; j++) {
+                if(j & (1 << i)) {
+                    pattern |= ((TruthWord) 1) << j;
+                }
+            }
+            for(w = 0; w < PROGRAM_BLOCK_WORDS; w++) {
+                registers[i * PROGRAM_BLOCK_WORDS + w] = pattern;
+            }
+        } else {
+            for(w = 0; w < PROGRAM_BLOCK_WORDS; w++) {
+                base = firstVector + w * TRUTH_WORD_BITS;
+                pattern = 0;
+                if((base >> i) & 1) {
+                    pattern = ~((TruthWord) 0);
+                }
+                registers[i * PROGRAM_BLOCK_WORDS + w] = pattern;
+            }
+        }
+    }
+}
+
+void setProgramInputsForVectorList(CircuitProgram* program, TruthWord* registers, const int* vectors, int nVectors) {
+    int i, lane;
+    assert(nVectors <= PROGRAM_BLOCK_VECTORS);
+    memset(registers, 0, program->nInputs * PROGRAM_BLOCK_WORDS * sizeof(TruthWord));
+    for(lane = 0; lane < nVectors; lane++) {
+        for(i = 0; i < program->nInputs; i++) {
+            if((vectors[lane] >> i) & 1) {
+                registers[i * PROGRAM_BLOCK_WORDS + lane / TRUTH_WORD_BITS] |= 
+                    ((TruthWord) 1) << (lane % TRUTH_WORD_BITS);
+            }
+        }
+    }
+}
+
+void runCircuitProgram(CircuitProgram* program, TruthWord* registers) {
+    if(program->compiled != NULL) {
+        program->compiled(registers, PROGRAM_BLOCK_WORDS);
+        return;
+    }
+    runCircuitProgramWithFault(program, registers, -1, 0);
+}
+
+/*
+ * Runs the interpreter with every operator output belonging to valveNo held
+ * at stuckAt. A negative valveNo runs the fault-free circuit
+ */
+void runCircuitProgramWithFault(CircuitProgram* program, TruthWord* registers, int valveNo, int stuckAt) {
+    int i, w;
+    Instruction* instr;
+    TruthWord* dst;
+    TruthWord* a;
+    TruthWord* b;
+    TruthWord stuckWord = stuckAt ? ~((TruthWord) 0) : 0;
+    for(i = 0; i < program->nInstructions; i++) {
+        instr = &program->instructions[i];
+        dst = registers + instr->dst * PROGRAM_BLOCK_WORDS;
+        a = registers + instr->a * PROGRAM_BLOCK_WORDS;
+        b = registers + instr->b * PROGRAM_BLOCK_WORDS;
+        if(valveNo >= 0 && instr->valveNo == valveNo) {
+            for(w = 0; w < PROGRAM_BLOCK_WORDS; w++) {
+                dst[w] = stuckWord;
+            }
+            continue;
+        }
+        switch(instr->op) {
+            case INSTR_AND: {
+                for(w = 0; w < PROGRAM_BLOCK_WORDS; w++) {
+                    dst[w] = a[w] & b[w];
+                }
+                break;
+            }
+            case INSTR_OR: {
+                for(w = 0; w < PROGRAM_BLOCK_WORDS; w++) {
+                    dst[w] = a[w] | b[w];
+                }
+                break;
+            }
+            case INSTR_NOT: {
+                for(w = 0; w < PROGRAM_BLOCK_WORDS; w++) {
+                    dst[w] = ~a[w];
+                }
+                break;
+            }
+        }
+    }
+}
+
+int getProgramOutput(CircuitProgram* program, TruthWord* registers, int tpIndex, int lane) {
+    TruthWord* reg = registers + program->tpRegisters[tpIndex] * PROGRAM_BLOCK_WORDS;
+    return (reg[lane / TRUTH_WORD_BITS] >> (lane % TRUTH_WORD_BITS)) & 1;
+}
+
+/*
+ * Checks sampled TP values against the values the program expects for the
+ * sampled inputs, PROGRAM_BLOCK_VECTORS samples per pass. As checkTruthTable,
+ * dest gets the indices of the failing TPs of each sample and n how many
+ */
+void checkSamplesWithProgram(CircuitProgram* program, TruthWord* registers, int* samples, int nVectors, 
+        int* dest, int* n) {
+    int i, first, lane, nLanes;
+    int* vector;
+    for(first = 0; first < nVectors; first += PROGRAM_BLOCK_VECTORS) {
+        nLanes = nVectors - first < PROGRAM_BLOCK_VECTORS ? nVectors - first : PROGRAM_BLOCK_VECTORS;
+        memset(registers, 0, program->nInputs * PROGRAM_BLOCK_WORDS * sizeof(TruthWord));
+        for(lane = 0; lane < nLanes; lane++) {
+            vector = samples + (first + lane) * program->nTps;
+            for(i = 0; i < program->nInputs; i++) {
+                if(vector[i]) {
+                    registers[i * PROGRAM_BLOCK_WORDS + lane / TRUTH_WORD_BITS] |= 
+                        ((TruthWord) 1) << (lane % TRUTH_WORD_BITS);
+                }
+            }
+        }
+        runCircuitProgram(program, registers);
+        for(lane = 0; lane < nLanes; lane++) {
+            vector = samples + (first + lane) * program->nTps;
+            n[first + lane] = 0;
+            for(i = program->nInputs; i < program->nTps; i++) {
+                if(getProgramOutput(program, registers, i, lane) != (vector[i] != 0)) {
+                    dest[(first + lane) * program->nTps + n[first + lane]] = i;
+                    n[first + lane]++;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Prints the truth table of a set evaluated by the program, generating the
+ * rows a pass at a time rather than from stored tables
+ */
+void printProgramTruthTable(CircuitProgram* program, AssertionsSet* set) {
+    TruthWord* registers;
+    int i, j, first, nColumns, nRows, maxCellStringLen;
+    char** columns;
+    char*** rows;
+    assert(program != NULL && set != NULL);
+    if(program->nInputs > MAX_TRUTH_TABLE_INPUTS) {
+        printf(TRUTH_TABLE_TOO_WIDE_MESSAGE, program->nInputs);
+        return;
+    }
+    
+    maxCellStringLen = 8;
+    nColumns = set->nTp;
+    assert((columns = malloc(sizeof(char*) * nColumns)) != NULL);
+    for(i = 0; i < nColumns; i++) {
+        columns[i] = set->tps[i]->tpName;
+    }
+    nRows = 1 << program->nInputs;
+    assert((rows = malloc(sizeof(char**) * nRows)) != NULL);
+    registers = createProgramRegisters(program);
+    for(first = 0; first < nRows; first += PROGRAM_BLOCK_VECTORS) {
+        setProgramInputsForVectors(program, registers, first);
+        runCircuitProgram(program, registers);
+        for(i = first; i < nRows && i < first + PROGRAM_BLOCK_VECTORS; i++) {
+            rows[i] = malloc(sizeof(char*) * nColumns);
+            for(j = 0; j < nColumns; j++) {
+                rows[i][j] = malloc(sizeof(char) * maxCellStringLen);
+                snprintf(rows[i][j], maxCellStringLen, "%d", getProgramOutput(program, registers, j, i - first));
+            }
+        }
+    }
+    free(registers);
+    printTable(stdout, TRUTH_TABLE_TITLE, columns, nColumns, rows, nRows);
+    for(i = 0; i < nRows; i++) {
+        for(j = 0; j < nColumns; j++) {
+            free(rows[i][j]);
+        }
+        free(rows[i]);
+    }
+    free(rows);
+    free(columns);
+}
+
+void printProgram(CircuitProgram* program) {
+    int i, nColumns, maxCellStringLen;
+    char** columns;
+    char*** rows;
+    assert(program != NULL);
+    
+    maxCellStringLen = 16;
+    nColumns = 4;
+    assert((columns = malloc(sizeof(char*) * nColumns)) != NULL);
+    columns[0] = TABLE_INSTRUCTIONS_HEADING;
+    columns[1] = TABLE_LEVELS_HEADING;
+    columns[2] = TABLE_REGISTERS_HEADING;
+    columns[3] = TABLE_VECTORS_HEADING;
+    assert((rows = malloc(sizeof(char**))) != NULL);
+    assert((rows[0] = malloc(sizeof(char*) * nColumns)) != NULL);
+    for(i = 0; i < nColumns; i++) {
+        assert((rows[0][i] = malloc(sizeof(char) * maxCellStringLen)) != NULL);
+    }
+    snprintf(rows[0][0], maxCellStringLen, "%d", program->nInstructions);
+    snprintf(rows[0][1], maxCellStringLen, "%d", program->nLevels);
+    snprintf(rows[0][2], maxCellStringLen, "%d", program->nRegisters);
+    snprintf(rows[0][3], maxCellStringLen, "%d", PROGRAM_BLOCK_VECTORS);
+    printTable(stdout, TABLE_TITLE, columns, nColumns, rows, 1);
+    for(i = 0; i < nColumns; i++) {
+        free(rows[0][i]);
+    }
+    free(rows[0]);
+    free(rows);
+    free(columns);
+}
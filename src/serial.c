@@ -1,44 +1,190 @@
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <wiringPi.h>
-#include <wiringSerial.h>
+#include <string.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
 #include "assertions.h"
 #include "circuit.h"
 #include "serial.h"
 
+#define SERIAL_CRC8_POLYNOMIAL 0x07
+
+int getSerialSpeed(int baud, speed_t* speed) {
+    static const int bauds[] = { 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600 };
+    static const speed_t speeds[] = { B9600, B19200, B38400, B57600, B115200, B230400, B460800, B921600 };
+    int i;
+    for(i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++) {
+        if(bauds[i] == baud) {
+            *speed = speeds[i];
+            return 0;
+        }
+    }
+    fprintf(stderr, "Unsupported baud rate %d\n", baud);
+    return -1;
+}
+
+/*
+ * Opens the device raw at 8N1 with blocking writes, as wiringSerial did
+ */
 SerialHandle* setupSerial(const char* device, int baud) {
     SerialHandle* handle = NULL;
+    struct termios options;
+    speed_t speed;
     int fd;
-    fd = serialOpen(device, baud) ;
-    if(fd >= 0) {
-        handle = malloc(sizeof(SerialHandle));
-        handle->fd = fd;
-    } else {
+    if(getSerialSpeed(baud, &speed) < 0) {
+        return NULL;
+    }
+    fd = open(device, O_RDWR | O_NOCTTY | O_NDELAY | O_NONBLOCK);
+    if(fd < 0) {
         fprintf(stderr, "Could not open serial device \"%s\"\n", device);
+        return NULL;
     }
+    fcntl(fd, F_SETFL, O_RDWR);
+    tcgetattr(fd, &options);
+    cfmakeraw(&options);
+    cfsetispeed(&options, speed);
+    cfsetospeed(&options, speed);
+    options.c_cflag |= CLOCAL | CREAD;
+    options.c_cflag &= ~(PARENB | CSTOPB | CSIZE);
+    options.c_cflag |= CS8;
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 100;
+    tcsetattr(fd, TCSANOW, &options);
+    handle = malloc(sizeof(SerialHandle));
+    handle->fd = fd;
     return handle;
 }
 
 void writeSerialStr(SerialHandle* serial) {
-    serialPuts(serial->fd, "Hello World\n");
+    const char* str = "Hello World\n";
+    if(write(serial->fd, str, strlen(str)) < 0) {
+        fprintf(stderr, "Failed to write to the serial device\n");
+    }
 }
 
-void writeSerial(SerialHandle* serial, AssertionsSet* set, Wiring* wiring, int n) {
-    int i, wiringIndex, pinIndex;
-    char* send;
-    send = malloc(sizeof(char) * (wiring->maxPins + 2));
-    for(int i = 0; i < wiring->maxPins; i++) {
-        send[i] = '0';
+int getSerialProtocolByName(const char* name, SerialProtocol* protocol) {
+    if(strcmp(name, SERIAL_PROTOCOL_ASCII_NAME) == 0) {
+        *protocol = SERIAL_PROTOCOL_ASCII;
+    } else if(strcmp(name, SERIAL_PROTOCOL_BINARY_NAME) == 0) {
+        *protocol = SERIAL_PROTOCOL_BINARY;
+    } else {
+        fprintf(stderr, "Unknown serial protocol \"%s\"\n", name);
+        return -1;
     }
-    send[wiring->maxPins] = '\n';
-    send[wiring->maxPins + 1] = '\0';
+    return 0;
+}
+
+uint8_t getCrc8(const uint8_t* bytes, int n) {
+    uint8_t crc = 0;
+    int i, j;
+    for(i = 0; i < n; i++) {
+        crc ^= bytes[i];
+        for(j = 0; j < 8; j++) {
+            crc = crc & 0x80 ? (crc << 1) ^ SERIAL_CRC8_POLYNOMIAL : crc << 1;
+        }
+    }
+    return crc;
+}
+
+void renderAsciiFrame(char* frame, int nPins, const int* pins, int nInputs, int vector) {
+    int i;
+    memset(frame, '0', nPins);
+    frame[nPins] = '\n';
+    for(i = 0; i < nInputs; i++) {
+        if(pins[i] >= 0 && (vector >> i) & 1) {
+            frame[pins[i]] = '1';
+        }
+    }
+}
+
+void renderBinaryFrame(char* frame, int nPins, const int* pins, int nInputs, int vector, int seq) {
+    uint8_t* bytes = (uint8_t*) frame;
+    int i, payloadLen = (nPins + 7) / 8;
+    bytes[0] = SERIAL_FRAME_SYNC;
+    bytes[1] = seq & 0xFF;
+    bytes[2] = (seq >> 8) & 0xFF;
+    bytes[3] = payloadLen;
+    memset(bytes + SERIAL_FRAME_HEADER_LEN, 0, payloadLen);
+    for(i = 0; i < nInputs; i++) {
+        if(pins[i] >= 0 && (vector >> i) & 1) {
+            bytes[SERIAL_FRAME_HEADER_LEN + pins[i] / 8] |= 1 << (pins[i] % 8);
+        }
+    }
+    bytes[SERIAL_FRAME_HEADER_LEN + payloadLen] = getCrc8(bytes + 1, SERIAL_FRAME_HEADER_LEN - 1 + payloadLen);
+}
+
+/*
+ * Decodes the frame at the start of a buffer back into the vector it drives.
+ * Returns the number of bytes it took, 0 if the frame is not complete yet, or
+ * minus the number of bytes to skip when they cannot start a valid frame.
+ * ASCII lines carry no sequence number, so seq is set to -1 for them
+ */
+int readSerialFrame(SerialProtocol protocol, const char* bytes, int n, int nPins, const int* pins, 
+        int nInputs, int* vector, int* seq) {
+    const uint8_t* frame = (const uint8_t*) bytes;
+    const char* end;
+    int i, payloadLen, frameLen;
+    *vector = 0;
+    if(protocol == SERIAL_PROTOCOL_ASCII) {
+        end = memchr(bytes, '\n', n);
+        if(end == NULL) {
+            return 0;
+        }
+        frameLen = end - bytes + 1;
+        if(frameLen != nPins + 1) {
+            return -frameLen;
+        }
+        for(i = 0; i < nInputs; i++) {
+            if(pins[i] >= 0 && bytes[pins[i]] == '1') {
+                *vector |= 1 << i;
+            }
+        }
+        *seq = -1;
+        return frameLen;
+    }
+    if(frame[0] != SERIAL_FRAME_SYNC) {
+        return -1;
+    }
+    if(n < SERIAL_FRAME_HEADER_LEN) {
+        return 0;
+    }
+    payloadLen = frame[3];
+    frameLen = SERIAL_FRAME_HEADER_LEN + payloadLen + SERIAL_FRAME_CHECKSUM_LEN;
+    if(payloadLen != (nPins + 7) / 8) {
+        return -1;
+    }
+    if(n < frameLen) {
+        return 0;
+    }
+    if(getCrc8(frame + 1, SERIAL_FRAME_HEADER_LEN - 1 + payloadLen) != frame[frameLen - 1]) {
+        return -1;
+    }
+    for(i = 0; i < nInputs; i++) {
+        if(pins[i] >= 0 && (frame[SERIAL_FRAME_HEADER_LEN + pins[i] / 8] >> (pins[i] % 8)) & 1) {
+            *vector |= 1 << i;
+        }
+    }
+    *seq = frame[1] | (frame[2] << 8);
+    return frameLen;
+}
+
+/*
+ * Maps each input TP to the pin it drives, or -1 if it is not wired
+ */
+int* createSerialPinTable(AssertionsSet* set, Wiring* wiring) {
+    int i, wiringIndex, pinIndex;
+    int* pins;
+    assert((pins = malloc((set->nInputs + 1) * sizeof(int))) != NULL);
     for(i = 0; i < set->nInputs; i++) {
+        pins[i] = -1;
         wiringIndex = getIndexOfTPIndexInWiring(wiring, i);
         if(wiringIndex >= 0 && wiringIndex < wiring->nWires) {
             pinIndex = wiring->wires[wiringIndex]->writePin;
             if(pinIndex >= 0 && pinIndex < wiring->maxPins) {
-                send[pinIndex] = (n & (1 << i)) == 0 ? '0' : '1';
+                pins[i] = pinIndex;
             } else {
                 fprintf(stderr, "Invalid pin index: %d\n", pinIndex);
             }
@@ -46,12 +192,154 @@ void writeSerial(SerialHandle* serial, AssertionsSet* set, Wiring* wiring, int n
             fprintf(stderr, "Invalid wiring index: %d\n", wiringIndex);
         }
     }
-    //printf("%d => \"%s\"", n, send);
-    serialPuts(serial->fd, send); 
-    free(send);
+    return pins;
+}
+
+int countChangedInputs(int nInputs, int vector1, int vector2) {
+    int i, n = 0;
+    for(i = 0; i < nInputs; i++) {
+        n += ((vector1 ^ vector2) >> i) & 1;
+    }
+    return n;
+}
+
+/*
+ * Greedily orders a set of vectors so that each one changes as few inputs of
+ * the previous one as possible
+ */
+void orderVectorsByDistance(int nInputs, int* vectors, int nVectors) {
+    int i, j, best, bestDistance, distance, tmp;
+    for(i = 1; i < nVectors; i++) {
+        best = i;
+        bestDistance = nInputs + 1;
+        for(j = i; j < nVectors && bestDistance > 1; j++) {
+            distance = countChangedInputs(nInputs, vectors[i - 1], vectors[j]);
+            if(distance < bestDistance) {
+                best = j;
+                bestDistance = distance;
+            }
+        }
+        tmp = vectors[i];
+        vectors[i] = vectors[best];
+        vectors[best] = tmp;
+    }
+}
+
+void renderSweepFrame(SerialSweep* sweep, char* frame, int i) {
+    if(sweep->protocol == SERIAL_PROTOCOL_BINARY) {
+        renderBinaryFrame(frame, sweep->nPins, sweep->pins, sweep->nInputs, getSerialSweepVector(sweep, i), i);
+    } else {
+        renderAsciiFrame(frame, sweep->nPins, sweep->pins, sweep->nInputs, getSerialSweepVector(sweep, i));
+    }
+}
+
+/*
+ * Renders the frames for a whole sweep into one buffer. Without a list of
+ * vectors every vector is swept, in Gray code order if asked, so only one pin
+ * changes per frame. A given list is instead greedily reordered to the same
+ * end. Sweeps of more than SERIAL_SWEEP_MAX_RENDERED_FRAMES are streamed
+ * instead, each frame being rendered into a window of the buffer as it is
+ * fetched
+ */
+SerialSweep* createSerialSweep(AssertionsSet* set, Wiring* wiring, const int* vectors, 
+        int nVectors, int grayCode, SerialProtocol protocol) {
+    SerialSweep* sweep;
+    int i;
+    if(vectors == NULL && set->nInputs > SERIAL_SWEEP_MAX_INPUTS) {
+        fprintf(stderr, "Too many inputs to sweep every vector, use --atpg to sweep a test set\n");
+        return NULL;
+    }
+    if(protocol == SERIAL_PROTOCOL_BINARY && (wiring->maxPins + 7) / 8 > UINT8_MAX) {
+        fprintf(stderr, "Too many pins for a binary frame\n");
+        return NULL;
+    }
+    sweep = malloc(sizeof(SerialSweep));
+    sweep->protocol = protocol;
+    sweep->nFrames = vectors != NULL ? nVectors : (1 << set->nInputs);
+    if(protocol == SERIAL_PROTOCOL_BINARY) {
+        sweep->frameLen = SERIAL_FRAME_HEADER_LEN + (wiring->maxPins + 7) / 8 + SERIAL_FRAME_CHECKSUM_LEN;
+    } else {
+        sweep->frameLen = wiring->maxPins + 1;
+    }
+    sweep->grayCode = grayCode;
+    // Swept vectors are worked out from the frame number without a list
+    sweep->vectors = NULL;
+    if(vectors != NULL) {
+        assert((sweep->vectors = malloc((sweep->nFrames + 1) * sizeof(int))) != NULL);
+        memcpy(sweep->vectors, vectors, sweep->nFrames * sizeof(int));
+        if(grayCode) {
+            orderVectorsByDistance(set->nInputs, sweep->vectors, sweep->nFrames);
+        }
+    }
+    
+    sweep->pins = createSerialPinTable(set, wiring);
+    sweep->nPins = wiring->maxPins;
+    sweep->nInputs = set->nInputs;
+    sweep->nRendered = sweep->nFrames;
+    if(sweep->nFrames > SERIAL_SWEEP_MAX_RENDERED_FRAMES) {
+        sweep->nRendered = SERIAL_SWEEP_WINDOW_FRAMES;
+    }
+    assert((sweep->frames = malloc((size_t) sweep->nRendered * sweep->frameLen + 1)) != NULL);
+    if(sweep->nRendered == sweep->nFrames) {
+        for(i = 0; i < sweep->nFrames; i++) {
+            renderSweepFrame(sweep, sweep->frames + (size_t) i * sweep->frameLen, i);
+        }
+    }
+    return sweep;
+}
+
+void freeSerialSweep(SerialSweep* sweep) {
+    if(sweep != NULL) {
+        free(sweep->frames);
+        free(sweep->vectors);
+        free(sweep->pins);
+        free(sweep);
+    }
+}
+
+int getSerialSweepVector(SerialSweep* sweep, int frame) {
+    if(sweep->vectors != NULL) {
+        return sweep->vectors[frame];
+    }
+    return sweep->grayCode ? frame ^ (frame >> 1) : frame;
+}
+
+/*
+ * Returns the bytes of a frame. A streamed sweep renders the frame over the
+ * one SERIAL_SWEEP_WINDOW_FRAMES before it, so frames must be fetched in order
+ * and the bytes only used until that many more have been fetched
+ */
+const char* getSerialSweepFrame(SerialSweep* sweep, int frame) {
+    char* bytes = sweep->frames + (size_t) (frame % sweep->nRendered) * sweep->frameLen;
+    assert(frame >= 0 && frame < sweep->nFrames);
+    if(sweep->nRendered < sweep->nFrames) {
+        renderSweepFrame(sweep, bytes, frame);
+    }
+    return bytes;
+}
+
+/*
+ * Returns how many whole milliseconds it takes to send one frame at the baud rate
+ */
+int getSerialFrameMs(SerialSweep* sweep, int baud) {
+    long bits = (long) sweep->frameLen * SERIAL_BITS_PER_BYTE;
+    return (int) ((bits * 1000 + baud - 1) / baud);
+}
+
+void writeSerialFrame(SerialHandle* serial, SerialSweep* sweep, int frame) {
+    const char* bytes = getSerialSweepFrame(sweep, frame);
+    int written, n = 0;
+    while(n < sweep->frameLen) {
+        written = write(serial->fd, bytes + n, sweep->frameLen - n);
+        if(written < 0) {
+            fprintf(stderr, "Failed to write frame %d to the serial device\n", frame);
+            return;
+        }
+        n += written;
+    }
 }
 
 void teardownSerial(SerialHandle* serial) {
-    serialClose(serial->fd);
+    close(serial->fd);
     free(serial);
 }
\ No newline at end of file
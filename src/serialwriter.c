@@ -0,0 +1,309 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "serial.h"
+#include "serialwriter.h"
+#include "timeutil.h"
+
+#define SERIAL_READ_LEN 64
+
+void signalEventFd(int fd) {
+    uint64_t one = 1;
+    while(write(fd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+void waitForEventFd(int fd) {
+    uint64_t n;
+    while(read(fd, &n, sizeof(n)) < 0 && errno == EINTR);
+}
+
+void sleepUntil(int timerFd, const struct timespec* when) {
+    struct itimerspec timer;
+    uint64_t expirations;
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value = *when;
+    if(timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &timer, NULL) < 0) {
+        fprintf(stderr, "Could not arm the serial writer timer\n");
+        return;
+    }
+    while(read(timerFd, &expirations, sizeof(expirations)) < 0 && errno == EINTR);
+}
+
+void writeQueuedFrame(SerialHandle* serial, const QueuedFrame* queued) {
+    int written, n = 0;
+    while(n < queued->len) {
+        written = write(serial->fd, queued->bytes + n, queued->len - n);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Failed to write frame %d to the serial device\n", queued->frame);
+            return;
+        }
+        n += written;
+    }
+}
+
+/*
+ * The reader only sleeps on its eventfd once it has seen its ring empty, so
+ * a push only signals when the ring was empty. Pushing and checking the other
+ * side's position are sequentially consistent so that one of them always
+ * sees the other
+ */
+void reportEmittedFrame(SerialWriter* writer, const EmittedFrame* frame) {
+    unsigned int head = writer->emittedHead;
+    writer->emitted[head % SERIAL_WRITER_RING_SIZE] = *frame;
+    __atomic_store_n(&writer->emittedHead, head + 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&writer->emittedTail, __ATOMIC_SEQ_CST) == head) {
+        signalEventFd(writer->reportFd);
+    }
+}
+
+/*
+ * Frames are emitted on an absolute schedule one period apart, so time spent
+ * writing does not accumulate. When the queue runs dry the schedule restarts
+ * from the next frame queued, but never sooner than a period after the last
+ */
+void runPacedSerialWriter(SerialWriter* writer) {
+    struct timespec next, now;
+    unsigned int tail;
+    EmittedFrame emitted;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while(1) {
+        tail = writer->queueTail;
+        if(tail == __atomic_load_n(&writer->queueHead, __ATOMIC_SEQ_CST)) {
+            if(__atomic_load_n(&writer->stopping, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            waitForEventFd(writer->wakeFd);
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(compareTimespecs(&next, &now) > 0) {
+            sleepUntil(writer->timerFd, &next);
+        } else {
+            next = now;
+        }
+        writeQueuedFrame(writer->serial, &writer->queue[tail % SERIAL_WRITER_RING_SIZE]);
+        
+        emitted.frame = writer->queue[tail % SERIAL_WRITER_RING_SIZE].frame;
+        emitted.scheduled = next;
+        clock_gettime(CLOCK_MONOTONIC, &emitted.emitted);
+        emitted.acknowledged = emitted.emitted;
+        emitted.acked = 0;
+        reportEmittedFrame(writer, &emitted);
+        __atomic_store_n(&writer->queueTail, tail + 1, __ATOMIC_SEQ_CST);
+        addTimespecNs(&next, __atomic_load_n(&writer->periodNs, __ATOMIC_RELAXED));
+    }
+}
+
+int getQueuedFrameSeq(const QueuedFrame* queued) {
+    const uint8_t* bytes = (const uint8_t*) queued->bytes;
+    return bytes[1] | (bytes[2] << 8);
+}
+
+void acknowledgeFrame(SerialWriter* writer, unsigned int tail, unsigned int sent, int seq) {
+    unsigned int i;
+    EmittedFrame* frame;
+    for(i = tail; i != sent; i++) {
+        frame = &writer->inFlight[i % SERIAL_WRITER_RING_SIZE];
+        if(!frame->acked && getQueuedFrameSeq(&writer->queue[i % SERIAL_WRITER_RING_SIZE]) == seq) {
+            frame->acked = 1;
+            clock_gettime(CLOCK_MONOTONIC, &frame->acknowledged);
+            return;
+        }
+    }
+}
+
+void sendQueuedFrame(SerialWriter* writer, unsigned int position) {
+    EmittedFrame* frame = &writer->inFlight[position % SERIAL_WRITER_RING_SIZE];
+    writeQueuedFrame(writer->serial, &writer->queue[position % SERIAL_WRITER_RING_SIZE]);
+    clock_gettime(CLOCK_MONOTONIC, &frame->emitted);
+}
+
+/*
+ * Keeps up to ackWindow frames in flight. Frames are reported in order as the
+ * oldest is acknowledged, and the oldest is resent if its ack does not come
+ */
+void runAckedSerialWriter(SerialWriter* writer) {
+    struct pollfd fds[2];
+    struct timespec now;
+    uint8_t ack[SERIAL_ACK_LEN];
+    uint8_t bytes[SERIAL_READ_LEN];
+    unsigned int tail, head, sent = writer->queueTail;
+    EmittedFrame* oldest;
+    int i, n, timeoutMs, ackLen = 0;
+    fds[0].fd = writer->serial->fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = writer->wakeFd;
+    fds[1].events = POLLIN;
+    while(1) {
+        tail = writer->queueTail;
+        head = __atomic_load_n(&writer->queueHead, __ATOMIC_SEQ_CST);
+        for(; sent != head && sent - tail < (unsigned int) writer->ackWindow; sent++) {
+            oldest = &writer->inFlight[sent % SERIAL_WRITER_RING_SIZE];
+            oldest->frame = writer->queue[sent % SERIAL_WRITER_RING_SIZE].frame;
+            oldest->acked = 0;
+            writer->retries[sent % SERIAL_WRITER_RING_SIZE] = 0;
+            sendQueuedFrame(writer, sent);
+            oldest->scheduled = oldest->emitted;
+        }
+        if(tail == head) {
+            if(__atomic_load_n(&writer->stopping, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            waitForEventFd(writer->wakeFd);
+            continue;
+        }
+        
+        oldest = &writer->inFlight[tail % SERIAL_WRITER_RING_SIZE];
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        timeoutMs = SERIAL_ACK_TIMEOUT_MS - (int) getTimespecDiffMs(&now, &oldest->emitted);
+        if(poll(fds, 2, timeoutMs > 0 ? timeoutMs : 0) < 0 && errno != EINTR) {
+            fprintf(stderr, "Could not wait for acks from the TPG\n");
+        }
+        if(fds[1].revents & POLLIN) {
+            waitForEventFd(writer->wakeFd);
+        }
+        if(fds[0].revents & POLLIN) {
+            n = read(writer->serial->fd, bytes, SERIAL_READ_LEN);
+            for(i = 0; i < n; i++) {
+                if(ackLen == 0 && bytes[i] != SERIAL_ACK_SYNC) {
+                    continue;
+                }
+                ack[ackLen++] = bytes[i];
+                if(ackLen == SERIAL_ACK_LEN) {
+                    acknowledgeFrame(writer, tail, sent, ack[1] | (ack[2] << 8));
+                    ackLen = 0;
+                }
+            }
+        }
+        
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(!oldest->acked && getTimespecDiffMs(&now, &oldest->emitted) >= SERIAL_ACK_TIMEOUT_MS) {
+            if(writer->retries[tail % SERIAL_WRITER_RING_SIZE]++ < SERIAL_ACK_RETRIES) {
+                sendQueuedFrame(writer, tail);
+            } else {
+                fprintf(stderr, "Frame %d was never acknowledged by the TPG\n", oldest->frame);
+                oldest->acknowledged = now;
+                reportEmittedFrame(writer, oldest);
+                tail++;
+            }
+        }
+        for(; tail != sent && writer->inFlight[tail % SERIAL_WRITER_RING_SIZE].acked; tail++) {
+            reportEmittedFrame(writer, &writer->inFlight[tail % SERIAL_WRITER_RING_SIZE]);
+        }
+        __atomic_store_n(&writer->queueTail, tail, __ATOMIC_SEQ_CST);
+    }
+}
+
+void* runSerialWriter(void* arg) {
+    SerialWriter* writer = arg;
+    if(writer->ackWindow > 0) {
+        runAckedSerialWriter(writer);
+    } else {
+        runPacedSerialWriter(writer);
+    }
+    return NULL;
+}
+
+SerialWriter* createSerialWriter(SerialHandle* serial, int periodMs, int ackWindow) {
+    SerialWriter* writer;
+    assert(serial != NULL);
+    if(ackWindow < 0 || ackWindow > SERIAL_WRITER_RING_SIZE) {
+        fprintf(stderr, "The ack window must be between 0 and %d frames\n", SERIAL_WRITER_RING_SIZE);
+        return NULL;
+    }
+    assert((writer = malloc(sizeof(SerialWriter))) != NULL);
+    writer->serial = serial;
+    writer->periodNs = periodMs * NS_PER_MS;
+    writer->ackWindow = ackWindow;
+    writer->queueHead = 0;
+    writer->queueTail = 0;
+    writer->emittedHead = 0;
+    writer->emittedTail = 0;
+    writer->stopping = 0;
+    writer->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    writer->wakeFd = eventfd(0, EFD_CLOEXEC);
+    writer->reportFd = eventfd(0, EFD_CLOEXEC);
+    if(writer->timerFd < 0 || writer->wakeFd < 0 || writer->reportFd < 0) {
+        fprintf(stderr, "Could not create the serial writer's timer and events\n");
+        close(writer->timerFd);
+        close(writer->wakeFd);
+        close(writer->reportFd);
+        free(writer);
+        return NULL;
+    }
+    if(pthread_create(&writer->thread, NULL, runSerialWriter, writer) != 0) {
+        fprintf(stderr, "Could not start the serial writer thread\n");
+        close(writer->timerFd);
+        close(writer->wakeFd);
+        close(writer->reportFd);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+void freeSerialWriter(SerialWriter* writer) {
+    if(writer != NULL) {
+        __atomic_store_n(&writer->stopping, 1, __ATOMIC_RELEASE);
+        signalEventFd(writer->wakeFd);
+        pthread_join(writer->thread, NULL);
+        close(writer->timerFd);
+        close(writer->wakeFd);
+        close(writer->reportFd);
+        free(writer);
+    }
+}
+
+void setSerialWriterPeriod(SerialWriter* writer, int periodMs) {
+    __atomic_store_n(&writer->periodNs, periodMs * NS_PER_MS, __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns -1 without queueing if the emitted ring could overflow, in which
+ * case emitted frames should be read first. The writer is woken whenever it
+ * can send the frame straight away, which for the acked writer is whenever
+ * its window has room, and otherwise picks it up once acks make room. The
+ * frames of a streamed sweep must be queued in order, so none is overwritten
+ * while the writer still holds it
+ */
+int queueSerialFrame(SerialWriter* writer, SerialSweep* sweep, int frame) {
+    QueuedFrame* queued;
+    unsigned int head = writer->queueHead;
+    unsigned int window = writer->ackWindow > 0 ? writer->ackWindow : 1;
+    assert(sweep->nRendered == sweep->nFrames || sweep->nRendered >= SERIAL_WRITER_RING_SIZE);
+    if(head - writer->emittedTail >= SERIAL_WRITER_RING_SIZE) {
+        return -1;
+    }
+    queued = &writer->queue[head % SERIAL_WRITER_RING_SIZE];
+    queued->bytes = getSerialSweepFrame(sweep, frame);
+    queued->len = sweep->frameLen;
+    queued->frame = frame;
+    __atomic_store_n(&writer->queueHead, head + 1, __ATOMIC_SEQ_CST);
+    if(head - __atomic_load_n(&writer->queueTail, __ATOMIC_SEQ_CST) < window) {
+        signalEventFd(writer->wakeFd);
+    }
+    return 0;
+}
+
+int readEmittedFrame(SerialWriter* writer, EmittedFrame* dest, int block) {
+    unsigned int tail = writer->emittedTail;
+    while(tail == __atomic_load_n(&writer->emittedHead, __ATOMIC_SEQ_CST)) {
+        if(!block) {
+            return 0;
+        }
+        waitForEventFd(writer->reportFd);
+    }
+    *dest = writer->emitted[tail % SERIAL_WRITER_RING_SIZE];
+    __atomic_store_n(&writer->emittedTail, tail + 1, __ATOMIC_SEQ_CST);
+    return 1;
+}
@@ -0,0 +1,22 @@
+#include <time.h>
+#include "timeutil.h"
+
+void addTimespecNs(struct timespec* t, long ns) {
+    t->tv_nsec += ns;
+    t->tv_sec += t->tv_nsec / NS_PER_S;
+    t->tv_nsec %= NS_PER_S;
+}
+
+int compareTimespecs(const struct timespec* a, const struct timespec* b) {
+    if(a->tv_sec != b->tv_sec) {
+        return a->tv_sec < b->tv_sec ? -1 : 1;
+    }
+    if(a->tv_nsec != b->tv_nsec) {
+        return a->tv_nsec < b->tv_nsec ? -1 : 1;
+    }
+    return 0;
+}
+
+double getTimespecDiffMs(const struct timespec* end, const struct timespec* start) {
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / (double) NS_PER_MS;
+}
@@ -1,4 +1,5 @@
 #include <stdarg.h>
+#include <stdlib.h>
 #include <libxml/tree.h>
 #include <libxml/xmlstring.h>
 
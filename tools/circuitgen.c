@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include "assertions.h"
+#include "codegen.h"
+#include "program.h"
+
+#define PROGRAM_NAME "circuitgen"
+
+/*
+ * Generates a specialised C evaluator for a circuit file, to be built as a
+ * shared object and loaded by the monitor with --circuit-lib
+ */
+int main(int argc, char** argv) {
+    LIBXML_TEST_VERSION
+    
+    xmlDoc* doc;
+    xmlNode* root;
+    AssertionsSet* set;
+    CircuitProgram* program;
+    FILE* stream;
+    
+    if(argc != 3) {
+        fprintf(stderr, "Usage: %s <circuit.xml> <output.c>\n", argc > 0 ? argv[0] : PROGRAM_NAME);
+        return EXIT_FAILURE;
+    }
+    doc = xmlReadFile(argv[1], NULL, 0);
+    if(doc == NULL) {
+        fprintf(stderr, "Failed to parse %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    root = xmlDocGetRootElement(doc);
+    set = createUnevaluatedAssertionSetFromXMLNode(root);
+    if(set == NULL) {
+        xmlFreeDoc(doc);
+        return EXIT_FAILURE;
+    }
+    program = compileCircuitProgram(root, set);
+    xmlFreeDoc(doc);
+    if(program == NULL) {
+        freeAssertionSet(set);
+        return EXIT_FAILURE;
+    }
+    
+    stream = fopen(argv[2], "w");
+    if(stream == NULL) {
+        fprintf(stderr, "Could not open \"%s\" for writing\n", argv[2]);
+        freeCircuitProgram(program);
+        freeAssertionSet(set);
+        return EXIT_FAILURE;
+    }
+    writeCircuitSource(stream, set, program);
+    fclose(stream);
+    
+    freeCircuitProgram(program);
+    freeAssertionSet(set);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,565 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include "assertions.h"
+#include "circuit.h"
+#include "network.h"
+#include "program.h"
+#include "serial.h"
+#include "serialwriter.h"
+#include "timeutil.h"
+#include "edsac_representation.h"
+
+#define PROGRAM_NAME "nodesim"
+#define CIRCUIT_FILNAME "config/circuit.xml"
+#define WIRING_FILNAME "config/wiring.xml"
+#define TX_ADDRESS "127.0.0.1"
+#define TX_PORT 2000
+
+#define NODESIM_READ_LEN 256
+#define NODESIM_BUFFER_LEN 4096
+#define NODESIM_REPORT_QUEUE_SIZE 4096
+#define NODESIM_REPORT_MESSAGE "Simulated fault"
+#define NODESIM_NOISE_MESSAGE "Simulated noise"
+#define N_FAULT_MODES 3
+
+#define N_PARAMS 14
+#define MAX_ARG_LEN 64
+
+typedef struct {
+    int valveNo;
+    struct timespec due;
+} PendingReport;
+
+/*
+ * Stands in for the TPG and the node under test. Frames written to the pty
+ * are decoded back into vectors and run through the circuit with the
+ * simulated fault, and every vector that makes a TP deviate is reported as a
+ * hard valve error once the report delay has passed, no faster than maxRate
+ */
+typedef struct {
+    AssertionsSet* set;
+    CircuitProgram* program;
+    Wiring* wiring;
+    NetworkHandle* net;
+    SerialProtocol protocol;
+    int* pins;
+    TruthWord* registers;
+    int* samples;
+    int* failingTps;
+    int follow;
+    int faultIndex;
+    int valveNo;
+    CircuitFault fault;
+    int lastSeq;
+    int sweepFrame;
+    int sweepFrames;
+    int repeat;
+    int reportDelayMs;
+    double maxRate;
+    double noiseRate;
+    struct timespec nextSend;
+    struct timespec nextNoise;
+    PendingReport reports[NODESIM_REPORT_QUEUE_SIZE];
+    int reportHead;
+    int reportCount;
+    int nFrames;
+    int nBadBytes;
+    int nDetections;
+    int nSent;
+    int nNoise;
+    int nDropped;
+} NodeSimulator;
+
+static volatile sig_atomic_t running = true;
+
+void stopRunning(int signum) {
+    running = false;
+}
+
+int parseSimulatedFiles(const char* circuitFile, const char* wiringFile, AssertionsSet** set,
+        CircuitProgram** program, Wiring** wiring) {
+    xmlDoc* doc;
+    xmlNode* root;
+    doc = xmlReadFile(circuitFile, NULL, 0);
+    if(doc == NULL) {
+        fprintf(stderr, "Failed to parse %s\n", circuitFile);
+        return -1;
+    }
+    root = xmlDocGetRootElement(doc);
+    *set = createUnevaluatedAssertionSetFromXMLNode(root);
+    if(*set != NULL) {
+        *program = compileCircuitProgram(root, *set);
+    }
+    xmlFreeDoc(doc);
+    if(*set == NULL || *program == NULL) {
+        return -1;
+    }
+    doc = xmlReadFile(wiringFile, NULL, 0);
+    if(doc == NULL) {
+        fprintf(stderr, "Failed to parse %s\n", wiringFile);
+        return -1;
+    }
+    *wiring = createWiringFromXMLNode(*set, xmlDocGetRootElement(doc));
+    xmlFreeDoc(doc);
+    return *wiring != NULL ? 0 : -1;
+}
+
+/*
+ * Opens a raw pty for the monitor to use as its serial device. The slave is
+ * held open too so that reads keep working while no monitor is attached
+ */
+int openSimulatedSerial(const char* linkName, int* slaveFd) {
+    struct termios attrs;
+    const char* slaveName;
+    int fd;
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if(fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0 || (slaveName = ptsname(fd)) == NULL) {
+        fprintf(stderr, "Could not open a pseudo-terminal\n");
+        return -1;
+    }
+    *slaveFd = open(slaveName, O_RDWR | O_NOCTTY);
+    if(*slaveFd < 0 || tcgetattr(*slaveFd, &attrs) < 0) {
+        fprintf(stderr, "Could not open %s\n", slaveName);
+        close(fd);
+        return -1;
+    }
+    cfmakeraw(&attrs);
+    tcsetattr(*slaveFd, TCSANOW, &attrs);
+    printf("Serial device: %s\n", slaveName);
+    if(linkName[0] != '\0') {
+        unlink(linkName);
+        if(symlink(slaveName, linkName) < 0) {
+            fprintf(stderr, "Could not link %s to %s\n", linkName, slaveName);
+        } else {
+            printf("Serial device linked as: %s\n", linkName);
+        }
+    }
+    return fd;
+}
+
+/*
+ * Follows the monitor through its injections, which go through every valve
+ * in wiring order with no fault, SA0 and then SA1, one sweep each
+ */
+void selectFollowedFault(NodeSimulator* sim, int faultIndex) {
+    static const CircuitFault faults[N_FAULT_MODES] = { NONE, SA0, SA1 };
+    sim->faultIndex = faultIndex % (sim->wiring->nValves * N_FAULT_MODES);
+    sim->valveNo = sim->wiring->valves[sim->faultIndex / N_FAULT_MODES]->number;
+    sim->fault = faults[sim->faultIndex % N_FAULT_MODES];
+}
+
+/*
+ * Samples the TPs of the faulty circuit as the node would, and checks them
+ * against the values the program expects for the vector
+ */
+int isVectorDetected(NodeSimulator* sim, int vector) {
+    CircuitProgram* program = sim->program;
+    int i, nFailing;
+    if(sim->fault == NONE) {
+        return false;
+    }
+    setProgramInputsForVectorList(program, sim->registers, &vector, 1);
+    runCircuitProgramWithFault(program, sim->registers, sim->valveNo, sim->fault == SA1);
+    for(i = 0; i < program->nTps; i++) {
+        sim->samples[i] = getProgramOutput(program, sim->registers, i, 0);
+    }
+    checkSamplesWithProgram(program, sim->registers, sim->samples, 1, sim->failingTps, &nFailing);
+    return nFailing > 0;
+}
+
+void queueReport(NodeSimulator* sim, int valveNo, const struct timespec* now) {
+    PendingReport* report;
+    if(sim->reportCount == NODESIM_REPORT_QUEUE_SIZE) {
+        sim->nDropped++;
+        return;
+    }
+    report = &sim->reports[(sim->reportHead + sim->reportCount++) % NODESIM_REPORT_QUEUE_SIZE];
+    report->valveNo = valveNo;
+    report->due = *now;
+    addTimespecNs(&report->due, sim->reportDelayMs * NS_PER_MS);
+}
+
+void writeFrameAck(int fd, int seq) {
+    uint8_t ack[SERIAL_ACK_LEN] = { SERIAL_ACK_SYNC, seq & 0xFF, (seq >> 8) & 0xFF };
+    if(write(fd, ack, SERIAL_ACK_LEN) != SERIAL_ACK_LEN) {
+        fprintf(stderr, "Failed to acknowledge frame %d\n", seq);
+    }
+}
+
+/*
+ * Sequence numbers restart from 0 with each sweep, but also wrap within one
+ * longer than the sequence number can count, so a 0 straight after the
+ * highest sequence number only starts a sweep once the current one is whole.
+ * A resent first frame cannot be told from a one frame sweep, but frames are
+ * acknowledged at once so are not resent in practice
+ */
+int isSweepRestart(NodeSimulator* sim, int seq) {
+    return seq == 0 && !(sim->lastSeq == SERIAL_FRAME_SEQ_MASK && sim->sweepFrame < sim->sweepFrames);
+}
+
+/*
+ * Frames are only resent while still in the writer's ring, so a retry is at
+ * most that far behind the last frame seen
+ */
+int isRetriedFrame(NodeSimulator* sim, int seq) {
+    return ((sim->lastSeq - seq) & SERIAL_FRAME_SEQ_MASK) < SERIAL_WRITER_RING_SIZE;
+}
+
+void handleFrame(NodeSimulator* sim, int fd, int vector, int seq, const struct timespec* now) {
+    int i;
+    if(seq >= 0) {
+        writeFrameAck(fd, seq);
+        if(sim->lastSeq >= 0 && isSweepRestart(sim, seq)) {
+            if(sim->follow) {
+                selectFollowedFault(sim, sim->faultIndex + 1);
+            }
+            sim->sweepFrame = 0;
+        } else if(sim->lastSeq >= 0 && isRetriedFrame(sim, seq)) {
+            return;
+        }
+        sim->lastSeq = seq;
+        sim->sweepFrame++;
+    } else if(sim->follow && sim->nFrames > 0 && sim->nFrames % sim->sweepFrames == 0) {
+        selectFollowedFault(sim, sim->faultIndex + 1);
+    }
+    sim->nFrames++;
+    if(isVectorDetected(sim, vector)) {
+        sim->nDetections++;
+        for(i = 0; i < sim->repeat; i++) {
+            queueReport(sim, sim->valveNo, now);
+        }
+    }
+}
+
+/*
+ * Consumes every whole frame in the buffer, returning how many bytes are left
+ */
+int handleFrames(NodeSimulator* sim, int fd, char* buffer, int n) {
+    struct timespec now;
+    int used, vector, seq, start = 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while(start < n) {
+        used = readSerialFrame(sim->protocol, buffer + start, n - start, sim->wiring->maxPins,
+                sim->pins, sim->set->nInputs, &vector, &seq);
+        if(used == 0) {
+            break;
+        }
+        if(used < 0) {
+            sim->nBadBytes -= used;
+            start -= used;
+            continue;
+        }
+        handleFrame(sim, fd, vector, seq, &now);
+        start += used;
+    }
+    memmove(buffer, buffer + start, n - start);
+    return n - start;
+}
+
+int sendValveReport(NodeSimulator* sim, int valveNo, const char* text, const struct timespec* now) {
+    Message* msg = alloc_hard_error_valve(valveNo, text);
+    int result;
+    if(msg == NULL) {
+        return -1;
+    }
+    result = resendNetworkMessage(sim->net, msg);
+    free_message(msg);
+    if(sim->maxRate > 0) {
+        sim->nextSend = *now;
+        addTimespecNs(&sim->nextSend, (long) (NS_PER_S / sim->maxRate));
+    }
+    return result;
+}
+
+int getWaitMs(const struct timespec* until, const struct timespec* now) {
+    double ms = getTimespecDiffMs(until, now);
+    return ms > 0 ? (int) ms + 1 : 0;
+}
+
+/*
+ * Sends whatever is due and returns how long until something else will be,
+ * or -1 if nothing is waiting
+ */
+int sendDueReports(NodeSimulator* sim) {
+    PendingReport* report;
+    struct timespec now, next;
+    int waitMs = -1;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(sim->noiseRate > 0 && compareTimespecs(&now, &sim->nextNoise) >= 0 &&
+            compareTimespecs(&now, &sim->nextSend) >= 0) {
+        sendValveReport(sim, sim->wiring->valves[rand() % sim->wiring->nValves]->number,
+                NODESIM_NOISE_MESSAGE, &now);
+        sim->nNoise++;
+        addTimespecNs(&sim->nextNoise, (long) (NS_PER_S / sim->noiseRate));
+    }
+    while(sim->reportCount > 0) {
+        report = &sim->reports[sim->reportHead];
+        next = compareTimespecs(&report->due, &sim->nextSend) > 0 ? report->due : sim->nextSend;
+        if(compareTimespecs(&now, &next) < 0) {
+            break;
+        }
+        if(sendValveReport(sim, report->valveNo, NODESIM_REPORT_MESSAGE, &now) >= 0) {
+            sim->nSent++;
+        }
+        sim->reportHead = (sim->reportHead + 1) % NODESIM_REPORT_QUEUE_SIZE;
+        sim->reportCount--;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+    if(sim->reportCount > 0) {
+        waitMs = getWaitMs(&next, &now);
+    }
+    if(sim->noiseRate > 0) {
+        next = compareTimespecs(&sim->nextNoise, &sim->nextSend) > 0 ? sim->nextNoise : sim->nextSend;
+        if(waitMs < 0 || getWaitMs(&next, &now) < waitMs) {
+            waitMs = getWaitMs(&next, &now);
+        }
+    }
+    return waitMs;
+}
+
+void runNodeSimulator(NodeSimulator* sim, int fd) {
+    struct pollfd pfd;
+    char buffer[NODESIM_BUFFER_LEN];
+    int n = 0, bytes, timeoutMs;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while(running) {
+        timeoutMs = sendDueReports(sim);
+        if(poll(&pfd, 1, timeoutMs) < 0) {
+            if(errno != EINTR) {
+                fprintf(stderr, "Failed to wait for frames\n");
+                return;
+            }
+            continue;
+        }
+        if(!(pfd.revents & POLLIN)) {
+            continue;
+        }
+        bytes = read(fd, buffer + n, NODESIM_BUFFER_LEN - n < NODESIM_READ_LEN ? NODESIM_BUFFER_LEN - n : NODESIM_READ_LEN);
+        if(bytes < 0) {
+            if(errno != EINTR && errno != EAGAIN) {
+                fprintf(stderr, "Failed to read frames\n");
+                return;
+            }
+            continue;
+        }
+        n = handleFrames(sim, fd, buffer, n + bytes);
+        if(n == NODESIM_BUFFER_LEN) {
+            // Nothing in a full buffer could be decoded
+            sim->nBadBytes += n;
+            n = 0;
+        }
+    }
+}
+
+int getFaultByName(const char* name, CircuitFault* fault) {
+    if(strcmp(name, "none") == 0) {
+        *fault = NONE;
+    } else if(strcmp(name, "sa0") == 0) {
+        *fault = SA0;
+    } else if(strcmp(name, "sa1") == 0) {
+        *fault = SA1;
+    } else {
+        fprintf(stderr, "Unknown fault \"%s\"\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    const char* name;
+    const char* format;
+    void* dest;
+    const char* argsName;
+    const char* description;
+} CmdLineParam;
+
+/*
+ * Simulates the TPG and the node under test on any Linux machine, so that the
+ * monitor can be run end to end against a pty and UDP on localhost
+ */
+int main(int argc, char** argv) {
+    LIBXML_TEST_VERSION
+
+    NodeSimulator sim;
+    AssertionsSet* set = NULL;
+    CircuitProgram* program = NULL;
+    Wiring* wiring = NULL;
+    char circuitFile[MAX_ARG_LEN + 1] = CIRCUIT_FILNAME;
+    char wiringFile[MAX_ARG_LEN + 1] = WIRING_FILNAME;
+    char linkName[MAX_ARG_LEN + 1] = "";
+    char protocolName[MAX_ARG_LEN + 1] = SERIAL_PROTOCOL_ASCII_NAME;
+    char txAddr[MAX_ARG_LEN + 1] = TX_ADDRESS;
+    char faultName[MAX_ARG_LEN + 1] = "sa0";
+    char* programName = argc > 0 ? argv[0] : PROGRAM_NAME;
+    int txPort = TX_PORT, valveNo = -1, sweepFrames = 0, repeat = 1, reportDelayMs = 0;
+    double maxRate = 0, noiseRate = 0;
+    int helpMessage = 0, optionsParsingFailed = 0;
+    int i, j, k, fd, slaveFd;
+
+    CmdLineParam params[N_PARAMS] = {
+        { .name="--circuit", .format="%s", .dest=circuitFile, .argsName="<file>", .description="The circuit to simulate"},
+        { .name="--wiring", .format="%s", .dest=wiringFile, .argsName="<file>", .description="The wiring of the circuit's inputs to TPG pins"},
+        { .name="--link", .format="%s", .dest=linkName, .argsName="<path>", .description="Create a symlink to the simulated serial device"},
+        { .name="--protocol", .format="%s", .dest=protocolName, .argsName="<ascii|binary>", .description="The framing the monitor sends vectors with"},
+        { .name="--tx-addr", .format="%s", .dest=txAddr, .argsName="<address>", .description="The IP address to send error messages to"},
+        { .name="--tx-port", .format="%d", .dest=&txPort, .argsName="<port>", .description="The IP port to send error messages to"},
+        { .name="--valve", .format="%d", .dest=&valveNo, .argsName="<n>", .description="Always simulate a fault on this valve rather than following the monitor's injections"},
+        { .name="--fault", .format="%s", .dest=faultName, .argsName="<none|sa0|sa1>", .description="The fault to simulate on the valve given with --valve"},
+        { .name="--sweep-frames", .format="%d", .dest=&sweepFrames, .argsName="<n>", .description="The number of frames per injection when following the monitor, every vector by default. Binary frames only need it to tell wrapped sequence numbers from new sweeps"},
+        { .name="--report-delay-ms", .format="%d", .dest=&reportDelayMs, .argsName="<ms>", .description="How long the node takes to report a detecting vector"},
+        { .name="--max-rate", .format="%lf", .dest=&maxRate, .argsName="<n>", .description="Send at most n messages a second, queueing the rest"},
+        { .name="--repeat", .format="%d", .dest=&repeat, .argsName="<n>", .description="Report each detecting vector n times"},
+        { .name="--noise-rate", .format="%lf", .dest=&noiseRate, .argsName="<n>", .description="Also send n error messages a second for random valves"},
+        { .name="--help", .format=NULL, .dest=&helpMessage, .argsName=NULL, .description="Display this help message"}
+    };
+
+    for(i = 1; i < argc && !optionsParsingFailed; i++) {
+        for(j = 0; j < N_PARAMS; j++) {
+            if(strcmp(argv[i], params[j].name) == 0) {
+                if(params[j].format != NULL) {
+                    i++;
+                    if(i >= argc) {
+                        fprintf(stderr, "No value specified for %s option\n", params[j].name);
+                        optionsParsingFailed = 1;
+                        break;
+                    }
+                    if(strlen(argv[i]) > MAX_ARG_LEN) {
+                        fprintf(stderr, "Value specified for %s option, \"%s\", is too large. Maximum length is %d\n", params[j].name, argv[i], MAX_ARG_LEN);
+                        optionsParsingFailed = 1;
+                        break;
+                    }
+                    k = sscanf(argv[i], params[j].format, params[j].dest);
+                    if(k != 1) {
+                        fprintf(stderr, "Value specified for %s option, \"%s\", could not be parsed (%d)\n", params[j].name, argv[i], k);
+                        optionsParsingFailed = 1;
+                        break;
+                    }
+                } else {
+                    *((int*)params[j].dest) = true;
+                }
+                break;
+            }
+        }
+        if(j >= N_PARAMS) {
+            fprintf(stderr, "Unrecognised option, \"%s\"\n", argv[i]);
+            optionsParsingFailed = 1;
+        }
+    }
+    if(!optionsParsingFailed && (getSerialProtocolByName(protocolName, &sim.protocol) < 0 ||
+            getFaultByName(faultName, &sim.fault) < 0)) {
+        optionsParsingFailed = 1;
+    }
+    if(!optionsParsingFailed && (repeat < 1 || reportDelayMs < 0 || maxRate < 0 || noiseRate < 0)) {
+        fprintf(stderr, "Repeats, delays and rates cannot be negative\n");
+        optionsParsingFailed = 1;
+    }
+    if(optionsParsingFailed) {
+        printf("Try \"%s --help\" for help on using this program\n", programName);
+        return EXIT_FAILURE;
+    }
+    if(helpMessage) {
+        printf("Usage: %s [options]\nOptions:\n", programName);
+        k = 0;
+        for(j = 0; j < N_PARAMS; j++) {
+            i = strlen(params[j].name) + (params[j].argsName != NULL ? 1 + strlen(params[j].argsName) : 0);
+            k = i > k ? i : k;
+        }
+        for(j = 0; j < N_PARAMS; j++) {
+            i = printf("  %s %s", params[j].name, params[j].argsName != NULL ? params[j].argsName : "");
+            printf("%*s %s\n", k + 3 - i, "", params[j].description);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if(parseSimulatedFiles(circuitFile, wiringFile, &set, &program, &wiring) < 0) {
+        return EXIT_FAILURE;
+    }
+    if(wiring->nValves == 0) {
+        fprintf(stderr, "There are no valves to simulate faults on\n");
+        return EXIT_FAILURE;
+    }
+    sim.net = setupNetwork(NULL, 0, txAddr, txPort);
+    if(sim.net == NULL) {
+        return EXIT_FAILURE;
+    }
+    fd = openSimulatedSerial(linkName, &slaveFd);
+    if(fd < 0) {
+        return EXIT_FAILURE;
+    }
+
+    sim.set = set;
+    sim.program = program;
+    sim.wiring = wiring;
+    sim.pins = createSerialPinTable(set, wiring);
+    sim.registers = createProgramRegisters(program);
+    assert((sim.samples = malloc((program->nTps + 1) * sizeof(int))) != NULL);
+    assert((sim.failingTps = malloc((program->nTps + 1) * sizeof(int))) != NULL);
+    sim.follow = valveNo < 0;
+    if(sim.follow) {
+        selectFollowedFault(&sim, 0);
+    } else {
+        sim.valveNo = valveNo;
+    }
+    sim.lastSeq = -1;
+    sim.sweepFrame = 0;
+    sim.sweepFrames = sweepFrames > 0 ? sweepFrames : 1 << set->nInputs;
+    sim.repeat = repeat;
+    sim.reportDelayMs = reportDelayMs;
+    sim.maxRate = maxRate;
+    sim.noiseRate = noiseRate;
+    clock_gettime(CLOCK_MONOTONIC, &sim.nextSend);
+    sim.nextNoise = sim.nextSend;
+    sim.reportHead = 0;
+    sim.reportCount = 0;
+    sim.nFrames = 0;
+    sim.nBadBytes = 0;
+    sim.nDetections = 0;
+    sim.nSent = 0;
+    sim.nNoise = 0;
+    sim.nDropped = 0;
+    printf("TX: %s:%d\nProtocol: %s\n", txAddr, txPort, protocolName);
+    if(sim.follow) {
+        printf("Following the monitor's fault injections\n");
+    } else {
+        printf("Simulating valve %d with fault=%d\n", sim.valveNo, sim.fault);
+    }
+    fflush(stdout);
+
+    signal(SIGINT, stopRunning);
+    signal(SIGTERM, stopRunning);
+    runNodeSimulator(&sim, fd);
+
+    printf("Decoded %d frames, skipping %d bad bytes, %d of which detected the fault\n",
+            sim.nFrames, sim.nBadBytes, sim.nDetections);
+    printf("Sent %d reports and %d noise messages, %d dropped and %d still queued\n",
+            sim.nSent, sim.nNoise, sim.nDropped, sim.reportCount);
+    if(linkName[0] != '\0') {
+        unlink(linkName);
+    }
+    close(slaveFd);
+    close(fd);
+    teardownNetwork(sim.net);
+    free(sim.pins);
+    free(sim.registers);
+    free(sim.samples);
+    free(sim.failingTps);
+    freeWiring(wiring);
+    freeCircuitProgram(program);
+    freeAssertionSet(set);
+    return EXIT_SUCCESS;
+}